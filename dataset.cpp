@@ -1,56 +1,293 @@
 #include "dataset.h"
 
 #include <iostream>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
 
 #include "util.h"
 
 
-dataset::dataset(const char* file_path, bool in_memory, std::atomic_bool& abort_flag, std::function<void(element_id, const std::string&)> element_handler)
-	: path_(file_path), in_memory_(in_memory), reader_(file_path)
+namespace
 {
-	if (!reader_.is_open())
+	// the file is read in blocks of about this many bytes, cut at line boundaries
+	constexpr size_t chunk_size = 1 << 20;
+
+	// a block of whole lines, parsed by one of the workers
+	struct chunk
+	{
+		// owns the lines if they were read rather than mapped
+		std::string buffer;
+		std::string_view data;
+		uint64_t offset = 0;
+		std::vector<std::string_view> lines;
+		std::vector<dataset::parsed_element> elements;
+		bool parsed = false;
+	};
+
+	void parse_chunk(chunk &chunk, const dataset::element_parser &parser)
+	{
+		for (size_t start = 0; start < chunk.data.size();)
+		{
+			size_t end = chunk.data.find('\n', start);
+			if (end == std::string_view::npos)
+			{
+				end = chunk.data.size();
+			}
+			chunk.lines.push_back(chunk.data.substr(start, end - start));
+			start = end + 1;
+		}
+
+		chunk.elements.resize(chunk.lines.size());
+		for (size_t i = 0; i < chunk.lines.size(); i++)
+		{
+			try
+			{
+				parser(chunk.lines[i], chunk.elements[i]);
+			}
+			catch (const std::exception &e)
+			{
+				chunk.elements[i].error = e.what();
+			}
+			catch (...)
+			{
+				chunk.elements[i].error = "unknown error";
+			}
+		}
+	}
+}
+
+// the constructing thread reads the file in chunks (or cuts the mapping into chunks) and hands them to the parse workers.
+// once enough chunks are in flight, it commits the oldest one, so ids and offsets are assigned in file order
+dataset::dataset(const char* file_path, storage storage, std::atomic_bool& abort_flag, element_parser parser, element_handler handler)
+	: path_(file_path), storage_(storage)
+{
+	if (storage_ == storage::mapped ? !map_file() : (reader_.open(file_path, std::ios::binary), !reader_.is_open()))
 	{
 		std::cerr << "could not open dataset \"" << file_path << '"' << std::endl;
 		return;
 	}
-	std::string line;
+
+	const unsigned worker_count = std::max(1u, std::thread::hardware_concurrency());
+	const size_t max_chunks_in_flight = 2 * worker_count;
+
+	std::mutex mutex;
+	std::condition_variable work_available, chunk_parsed;
+	// chunks no worker has picked up yet
+	std::deque<chunk *> pending;
+	// chunks that have not been committed yet, in file order
+	std::deque<std::unique_ptr<chunk>> in_flight;
+	bool reading_done = false;
+
+	std::vector<std::thread> workers;
+	for (unsigned i = 0; i < worker_count; i++)
+	{
+		workers.emplace_back([&]
+		{
+			std::unique_lock lock(mutex);
+			while (true)
+			{
+				work_available.wait(lock, [&] { return reading_done || !pending.empty(); });
+				if (pending.empty())
+				{
+					return;
+				}
+				chunk *next = pending.front();
+				pending.pop_front();
+				lock.unlock();
+				parse_chunk(*next, parser);
+				lock.lock();
+				next->parsed = true;
+				chunk_parsed.notify_all();
+			}
+		});
+	}
+
 	element_id line_count = 0;
-	uint64_t offset = 0;
-	while (std::getline(reader_, line), !line.empty() || !reader_.eof())
+	const auto commit_oldest = [&]
 	{
-		if (abort_flag)
+		std::unique_ptr<chunk> oldest;
 		{
-			return;
+			std::unique_lock lock(mutex);
+			chunk_parsed.wait(lock, [&] { return in_flight.front()->parsed; });
+			oldest = std::move(in_flight.front());
+			in_flight.pop_front();
 		}
+		for (size_t i = 0; i < oldest->lines.size(); i++)
+		{
+			const std::string_view line = oldest->lines[i];
+			try
+			{
+				handler(line_count, line, std::move(oldest->elements[i]));
+			}
+			catch(...)
+			{
+			}
 
-		try
+			if (storage_ == storage::memory)
+			{
+				elements_.emplace_back(line);
+			}
+			file_offsets_.push_back(oldest->offset + (line.data() - oldest->data.data()));
+			line_lengths_.push_back(line.size());
+			++line_count;
+		}
+	};
+	const auto submit = [&](std::unique_ptr<chunk> next)
+	{
 		{
-			element_handler(line_count, line);
+			std::lock_guard lock(mutex);
+			pending.push_back(next.get());
+			in_flight.push_back(std::move(next));
 		}
-		catch(...)
+		work_available.notify_one();
+
+		while (in_flight.size() >= max_chunks_in_flight && !abort_flag)
 		{
+			commit_oldest();
 		}
+	};
 
-		if (in_memory)
+	if (storage_ == storage::mapped)
+	{
+		const std::string_view file(mapping_, mapping_size_);
+		madvise(const_cast<char *>(mapping_), mapping_size_, MADV_SEQUENTIAL);
+		for (size_t offset = 0; !abort_flag && offset < file.size();)
 		{
-			elements_.push_back(line);
+			const size_t newline = file.find('\n', std::min(offset + chunk_size, file.size()) - 1);
+			const size_t end = newline == std::string_view::npos ? file.size() : newline + 1;
+			auto next = std::make_unique<chunk>();
+			next->offset = offset;
+			next->data = file.substr(offset, end - offset);
+			submit(std::move(next));
+			offset = end;
 		}
-		else
+	}
+	else
+	{
+		std::string buffer;
+		uint64_t offset = 0;
+		while (!abort_flag && (reader_ || !buffer.empty()))
 		{
-			file_offsets_.push_back(offset);
-			offset = reader_.tellg();
+			const size_t buffered = buffer.size();
+			buffer.resize(buffered + chunk_size);
+			reader_.read(buffer.data() + buffered, chunk_size);
+			buffer.resize(buffered + reader_.gcount());
+
+			// an incomplete last line waits for the next read, unless the file ended
+			size_t end = buffer.size();
+			if (reader_)
+			{
+				const size_t newline = buffer.rfind('\n');
+				if (newline == std::string::npos)
+				{
+					continue;
+				}
+				end = newline + 1;
+			}
+			auto next = std::make_unique<chunk>();
+			next->offset = offset;
+			next->buffer.assign(buffer, 0, end);
+			next->data = next->buffer;
+			buffer.erase(0, end);
+			offset += end;
+			submit(std::move(next));
 		}
-		++line_count;
 	}
-	reader_.clear(std::fstream::eofbit);
-	if (reader_.bad() || reader_.fail())
+	while (!in_flight.empty() && !abort_flag)
+	{
+		commit_oldest();
+	}
+
+	{
+		std::lock_guard lock(mutex);
+		reading_done = true;
+		pending.clear();
+	}
+	work_available.notify_all();
+	for (auto &worker : workers)
+	{
+		worker.join();
+	}
+	if (abort_flag)
+	{
+		return;
+	}
+
+	if (storage_ == storage::mapped)
+	{
+		// drop the pages touched while parsing, they are faulted back in from the page cache when needed.
+		// lookups from now on are scattered, so there is no point in reading ahead
+		madvise(const_cast<char *>(mapping_), mapping_size_, MADV_DONTNEED);
+		madvise(const_cast<char *>(mapping_), mapping_size_, MADV_RANDOM);
+		ready_ = true;
+		return;
+	}
+	if (reader_.bad())
 	{
 		std::cerr << "file error" << std::endl; 
 		return;
 	}
-	if (in_memory)
+	reader_.close();
+	// disk mode reads lines with pread, so concurrent requests don't share a file position
+	if (storage_ == storage::disk && (file_ = open(path_, O_RDONLY)) < 0)
 	{
-		reader_.close();
+		std::cerr << "could not reopen dataset \"" << path_ << '"' << std::endl;
+		return;
+	}
+	ready_ = true;
+}
+
+dataset::dataset(const char* file_path, storage storage, std::vector<uint64_t> file_offsets, std::vector<uint32_t> line_lengths)
+	: file_offsets_(std::move(file_offsets)), line_lengths_(std::move(line_lengths)), path_(file_path), storage_(storage)
+{
+	switch (storage_)
+	{
+	case storage::memory:
+	{
+		// the lines are read one by one, a copy of the whole file would double the memory needed
+		std::ifstream reader(file_path, std::ios::binary);
+		elements_.reserve(file_offsets_.size());
+		uint64_t position = 0;
+		for (size_t id = 0; id < file_offsets_.size(); id++)
+		{
+			// lines follow each other, so skipping ahead avoids seeking, which drops the read buffer
+			if (file_offsets_[id] >= position)
+				reader.ignore(file_offsets_[id] - position);
+			else
+				reader.seekg(file_offsets_[id]);
+			std::string &line = elements_.emplace_back(line_lengths_[id], '\0');
+			if (!reader.read(line.data(), line.size()))
+			{
+				std::cerr << "could not read dataset \"" << file_path << '"' << std::endl;
+				elements_.clear();
+				return;
+			}
+			position = file_offsets_[id] + line_lengths_[id];
+		}
+		break;
+	}
+	case storage::disk:
+		if ((file_ = open(path_, O_RDONLY)) < 0)
+		{
+			std::cerr << "could not open dataset \"" << file_path << '"' << std::endl;
+			return;
+		}
+		break;
+	case storage::mapped:
+		if (!map_file())
+		{
+			std::cerr << "could not open dataset \"" << file_path << '"' << std::endl;
+			return;
+		}
+		madvise(const_cast<char *>(mapping_), mapping_size_, MADV_RANDOM);
+		break;
 	}
 	ready_ = true;
 }
@@ -58,27 +295,92 @@ dataset::dataset(const char* file_path, bool in_memory, std::atomic_bool& abort_
 dataset::~dataset()
 {
 	reader_.close();
+	if (file_ >= 0)
+	{
+		close(file_);
+	}
+	if (mapping_)
+	{
+		munmap(const_cast<char *>(mapping_), mapping_size_);
+	}
 }
 
-std::string dataset::get_element(element_id id)
+bool dataset::map_file()
 {
-	std::string line;
-	if (in_memory_)
+	const int file = open(path_, O_RDONLY);
+	if (file < 0)
 	{
-		line = elements_[id];
+		return false;
 	}
-	else
+	struct stat file_stat;
+	if (fstat(file, &file_stat) != 0)
 	{
-		reader_.clear(std::fstream::eofbit);
-		reader_.seekg(file_offsets_[id]);
-		std::getline(reader_, line);
+		close(file);
+		return false;
 	}
-	return line;
+	if (file_stat.st_size > 0)
+	{
+		void *mapping = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+		if (mapping == MAP_FAILED)
+		{
+			close(file);
+			return false;
+		}
+		mapping_ = static_cast<const char *>(mapping);
+		mapping_size_ = file_stat.st_size;
+	}
+	// the mapping stays valid after closing the file
+	close(file);
+	return true;
+}
+
+std::string_view dataset::get_element(element_id id, std::string &buffer) const
+{
+	switch (storage_)
+	{
+	case storage::memory:
+		return elements_[id];
+	case storage::mapped:
+		return std::string_view(mapping_ + file_offsets_[id], line_lengths_[id]);
+	case storage::disk:
+		break;
+	}
+	buffer.resize(line_lengths_[id]);
+	for (size_t done = 0; done < buffer.size();)
+	{
+		const ssize_t count = pread(file_, buffer.data() + done, buffer.size() - done, file_offsets_[id] + done);
+		if (count <= 0)
+		{
+			if (count < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			buffer.resize(done);
+			break;
+		}
+		done += count;
+	}
+	return buffer;
 }
 
 size_t dataset::size() const
 {
-    return elements_.size();
+	return line_lengths_.size();
+}
+
+const char *dataset::path() const
+{
+	return path_;
+}
+
+const std::vector<uint64_t> &dataset::file_offsets() const
+{
+	return file_offsets_;
+}
+
+const std::vector<uint32_t> &dataset::line_lengths() const
+{
+	return line_lengths_;
 }
 
 bool dataset::ready() const
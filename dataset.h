@@ -2,6 +2,7 @@
 
 #include <vector>
 #include <string>
+#include <string_view>
 #include <fstream>
 #include <memory>
 #include <atomic>
@@ -9,19 +10,56 @@
 
 class dataset
 {
+public:
+	// where the lines are kept after loading
+	enum class storage
+	{
+		// copies of all lines, along with their offsets and lengths
+		memory,
+		// line offsets and lengths, lines are read from the file on every access
+		disk,
+		// line offsets and lengths into a read-only mapping of the file
+		mapped,
+	};
+
+private:
 	std::vector<uint64_t> file_offsets_;
+	std::vector<uint32_t> line_lengths_;
 	std::vector<std::string> elements_;
 
 	const char* path_;
-	const bool in_memory_;
+	const storage storage_;
 
+	// only used while loading
 	std::ifstream reader_;
+	// file descriptor for disk mode
+	int file_ = -1;
+	const char *mapping_ = nullptr;
+	size_t mapping_size_ = 0;
 	bool ready_ = false;
 
+	bool map_file();
+
 public:
 	using element_id = uint32_t;
 
-	dataset(const char *file_path, bool in_memory, std::atomic_bool &abort_flag, std::function<void(element_id, const std::string &)> element_handler);
+	// what a parse worker extracted from a line
+	struct parsed_element
+	{
+		std::string name;
+		// what the element is ranked by, 0 unless the parser sets it
+		float score = 0;
+		// set if the parser threw
+		std::string error;
+	};
+	// extracts the name (and score) from a line into the element. runs on the parse workers, so it has to be thread safe
+	using element_parser = std::function<void(std::string_view line, parsed_element &element)>;
+	// called for every line in file order, on the thread constructing the dataset
+	using element_handler = std::function<void(element_id, std::string_view line, parsed_element &&element)>;
+
+	dataset(const char *file_path, storage storage, std::atomic_bool &abort_flag, element_parser parser, element_handler handler);
+	// restores a dataset from the line offsets and lengths of an earlier load, without parsing it again
+	dataset(const char *file_path, storage storage, std::vector<uint64_t> file_offsets, std::vector<uint32_t> line_lengths);
 	~dataset();
 
 	dataset(dataset &&) = delete;
@@ -29,8 +67,14 @@ public:
 	dataset &operator=(dataset &&) = delete;
 	dataset &operator=(const dataset &) = delete;
 
-	std::string get_element(element_id id);
+	// the line of an element. buffer is only used if the line has to be read from disk,
+	// otherwise the view points into the dataset and stays valid as long as it does.
+	// safe to call from multiple threads
+	std::string_view get_element(element_id id, std::string &buffer) const;
 	size_t size() const;
+	const char *path() const;
+	const std::vector<uint64_t> &file_offsets() const;
+	const std::vector<uint32_t> &line_lengths() const;
 
 	bool ready() const;
 };
@@ -2,13 +2,25 @@
 
 #include <climits>
 #include <cassert>
+#include <cstdlib>
 #include <string>
 #include <vector>
 #include <unordered_map>
 #include <unordered_set>
 #include <map>
+#include <set>
 #include <algorithm>
 #include <ranges>
+#include <optional>
+#include <utility>
+#include <span>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <ostream>
+#include <type_traits>
+#include <queue>
+#include <numeric>
 
 namespace fuzzy
 {
@@ -22,6 +34,8 @@ namespace fuzzy
 
 	constexpr size_t bigram_limit = 6;
 	constexpr size_t trigram_limit = 12;
+	// bounded distance computations below this bound use a banded dp instead of the bit-parallel kernel
+	constexpr int banded_distance_limit = 3;
 
 	namespace internal
 	{
@@ -100,39 +114,231 @@ namespace fuzzy
 			return true;
 		}
 
-		inline int osa_distance(fuzzy::string_view s1, fuzzy::string_view s2)
+		// computes the osa distance between a pattern of at most 64 characters and a text,
+		// using Hyyrö's bit-parallel extension of Myers' algorithm.
+		// masks holds one bit vector per character, with bit i set if pattern[i] is that character.
+		// stops early and returns a value greater than max_distance once the distance is bound to exceed it
+		inline int osa_distance_word(const uint64_t* masks, size_t pattern_length, fuzzy::string_view text, int max_distance = INT_MAX)
 		{
-			const int len_s1 = s1.size();
-			const int len_s2 = s2.size();
+			assert(pattern_length > 0 && pattern_length <= 64);
+			const uint64_t last_bit = uint64_t(1) << (pattern_length - 1);
+			uint64_t vp = ~uint64_t(0);
+			uint64_t vn = 0;
+			uint64_t d0 = 0;
+			uint64_t prev_match = 0;
+			int distance = pattern_length;
+			int remaining = text.length();
+			for (const ngram_char c : text)
+			{
+				const uint64_t match = masks[c];
+				const uint64_t transposition = ((~d0 & match) << 1) & prev_match;
+				d0 = (((match & vp) + vp) ^ vp) | match | vn | transposition;
+				uint64_t hp = vn | ~(d0 | vp);
+				uint64_t hn = d0 & vp;
+				if (hp & last_bit)
+					++distance;
+				else if (hn & last_bit)
+					--distance;
+				// each remaining text character can lower the distance by at most one
+				if (distance - --remaining > max_distance)
+					return distance - remaining;
+				hp = (hp << 1) | 1;
+				hn = hn << 1;
+				vp = hn | ~(d0 | hp);
+				vn = d0 & hp;
+				prev_match = match;
+			}
+			return distance;
+		}
 
-			std::vector<int> prev(len_s2 + 1);
-			std::vector<int> curr(len_s2 + 1);
+		// same as osa_distance_word, but for patterns of any length.
+		// the bit vectors are split into 64 bit words, masks holds that many words per character
+		inline int osa_distance_blocks(const uint64_t* masks, size_t pattern_length, fuzzy::string_view text, int max_distance = INT_MAX)
+		{
+			assert(pattern_length > 0);
+			const size_t words = (pattern_length + 63) / 64;
+			const uint64_t last_bit = uint64_t(1) << ((pattern_length - 1) % 64);
+			std::vector<uint64_t> state(4 * words);
+			uint64_t* vp = state.data();
+			uint64_t* vn = vp + words;
+			uint64_t* d0 = vn + words;
+			uint64_t* prev_match = d0 + words;
+			std::fill(vp, vp + words, ~uint64_t(0));
+			int distance = pattern_length;
+			int remaining = text.length();
+			for (const ngram_char c : text)
+			{
+				const uint64_t* match_words = masks + size_t(c) * words;
+				// bits carried from the lower word into the next one
+				uint64_t sum_carry = 0, transposition_carry = 0, hp_carry = 1, hn_carry = 0;
+				for (size_t w = 0; w < words; ++w)
+				{
+					const uint64_t match = match_words[w];
+					const uint64_t shifted = ~d0[w] & match;
+					const uint64_t transposition = ((shifted << 1) | transposition_carry) & prev_match[w];
+					transposition_carry = shifted >> 63;
+
+					const uint64_t addend = match & vp[w];
+					const uint64_t partial_sum = addend + vp[w];
+					const uint64_t sum = partial_sum + sum_carry;
+					sum_carry = (partial_sum < addend) | (sum < partial_sum);
+
+					d0[w] = (sum ^ vp[w]) | match | vn[w] | transposition;
+					uint64_t hp = vn[w] | ~(d0[w] | vp[w]);
+					uint64_t hn = d0[w] & vp[w];
+					if (w + 1 == words)
+					{
+						if (hp & last_bit)
+							++distance;
+						else if (hn & last_bit)
+							--distance;
+					}
+					const uint64_t next_hp_carry = hp >> 63;
+					const uint64_t next_hn_carry = hn >> 63;
+					hp = (hp << 1) | hp_carry;
+					hn = (hn << 1) | hn_carry;
+					hp_carry = next_hp_carry;
+					hn_carry = next_hn_carry;
+					vp[w] = hn | ~(d0[w] | hp);
+					vn[w] = d0[w] & hp;
+					prev_match[w] = match;
+				}
+				if (distance - --remaining > max_distance)
+					return distance - remaining;
+			}
+			return distance;
+		}
 
-			for (int j = 0; j <= len_s2; j++)
+		// computes the osa distance with a dp that only evaluates cells at most max_distance away from the diagonal,
+		// and gives up as soon as the minimum of a row exceeds max_distance.
+		// returns a value greater than max_distance if the distance exceeds max_distance
+		inline int osa_distance_banded(fuzzy::string_view pattern, fuzzy::string_view text, int max_distance)
+		{
+			assert(max_distance >= 0 && max_distance < banded_distance_limit);
+			const int len_pattern = pattern.length();
+			const int len_text = text.length();
+			const int out_of_band = max_distance + 1;
+			if (std::abs(len_pattern - len_text) > max_distance)
 			{
-				prev[j] = j;
+				return out_of_band;
 			}
 
-			for (int i = 1; i <= len_s1; i++)
+			// rows are stored relative to the diagonal: cell (i, j) lives at index j - i + max_distance + 1,
+			// which leaves one padding cell on each side of the band
+			constexpr int row_size = 2 * banded_distance_limit + 3;
+			int rows[3][row_size];
+			int* before_prev = rows[0];
+			int* prev = rows[1];
+			int* curr = rows[2];
+			std::fill_n(before_prev, row_size, out_of_band);
+			std::fill_n(prev, row_size, out_of_band);
+			for (int j = 0; j <= std::min(max_distance, len_text); j++)
 			{
-				curr[0] = i;
-				for (int j = 1; j <= len_s2; j++)
-				{
-					const int cost = (s1[i - 1] == s2[j - 1]) ? 0 : 1;
-					curr[j] = std::min({
-						prev[j] + 1,        // deletion
-						curr[j - 1] + 1,    // insertion
-						prev[j - 1] + cost  // substitution
-					});
+				prev[j + max_distance + 1] = j;
+			}
 
-					if (s1[i - 1] == s2[j - 2] && s1[i - 2] == s2[j - 1] && i > 1 && j > 1)
+			for (int i = 1; i <= len_pattern; i++)
+			{
+				std::fill_n(curr, row_size, out_of_band);
+				int row_min = out_of_band;
+				const int last = std::min(len_text, i + max_distance);
+				for (int j = std::max(0, i - max_distance); j <= last; j++)
+				{
+					const int index = j - i + max_distance + 1;
+					int value = i;
+					if (j > 0)
 					{
-						curr[j] = std::min(curr[j], prev[j - 2] + 1); // transposition
+						const int cost = (pattern[i - 1] == text[j - 1]) ? 0 : 1;
+						value = std::min({
+							prev[index + 1] + 1, // deletion
+							curr[index - 1] + 1, // insertion
+							prev[index] + cost   // substitution
+						});
+						if (i > 1 && j > 1 && pattern[i - 1] == text[j - 2] && pattern[i - 2] == text[j - 1])
+						{
+							value = std::min(value, before_prev[index] + 1); // transposition
+						}
 					}
+					curr[index] = std::min(value, out_of_band);
+					row_min = std::min(row_min, curr[index]);
+				}
+				if (row_min > max_distance)
+				{
+					return out_of_band;
 				}
+				std::swap(before_prev, prev);
 				std::swap(prev, curr);
 			}
-			return prev[len_s2];
+			return prev[len_text - len_pattern + max_distance + 1];
+		}
+
+		// precomputed character masks of a fixed pattern,
+		// for computing the osa distance of many texts to the same pattern
+		class osa_matcher
+		{
+			fuzzy::string pattern_;
+			size_t length_;
+			std::vector<uint64_t> masks_;
+
+		public:
+			explicit osa_matcher(fuzzy::string_view pattern)
+				: pattern_(pattern), length_(pattern.length()), masks_(256 * ((pattern.length() + 63) / 64))
+			{
+				const size_t words = masks_.size() / 256;
+				for (size_t i = 0; i < pattern.length(); ++i)
+				{
+					masks_[size_t(pattern[i]) * words + i / 64] |= uint64_t(1) << (i % 64);
+				}
+			}
+
+			int distance(fuzzy::string_view text) const
+			{
+				if (length_ == 0)
+					return text.length();
+				if (length_ <= 64)
+					return osa_distance_word(masks_.data(), length_, text);
+				return osa_distance_blocks(masks_.data(), length_, text);
+			}
+
+			// like distance(text), but any value greater than max_distance only means
+			// that the distance exceeds max_distance. hopeless texts are abandoned early
+			int distance(fuzzy::string_view text, int max_distance) const
+			{
+				if (std::abs(int(length_) - int(text.length())) > max_distance)
+					return max_distance + 1;
+				if (max_distance < banded_distance_limit)
+					return osa_distance_banded(pattern_, text, max_distance);
+				if (length_ == 0)
+					return text.length();
+				if (length_ <= 64)
+					return osa_distance_word(masks_.data(), length_, text, max_distance);
+				return osa_distance_blocks(masks_.data(), length_, text, max_distance);
+			}
+		};
+
+		inline int osa_distance(fuzzy::string_view s1, fuzzy::string_view s2)
+		{
+			// the distance is symmetric, so the shorter string is used as the pattern
+			if (s1.length() > s2.length())
+				std::swap(s1, s2);
+			if (s1.empty())
+				return s2.length();
+			if (s1.length() > 64)
+				return osa_matcher(s1).distance(s2);
+
+			uint64_t masks[256] = {};
+			for (size_t i = 0; i < s1.length(); ++i)
+			{
+				masks[s1[i]] |= uint64_t(1) << i;
+			}
+			return osa_distance_word(masks, s1.length(), s2);
+		}
+
+		// q-gram lemma: a string within max_distance of the query still contains at least this many
+		// of the query's distinct ngrams. one osa edit destroys at most ngram_size + 1 ngrams (a transposition)
+		inline long min_shared_ngrams(size_t query_ngrams, int ngram_size, int max_distance)
+		{
+			return long(query_ngrams) - long(max_distance) * (ngram_size + 1);
 		}
 
 		inline std::vector<ngram_token> ngram_tokens(const fuzzy::string_view str, const int ngram_size)
@@ -183,6 +389,54 @@ namespace fuzzy
 
 	using namespace internal;
 
+	// counts ngram hits per element id in a dense array.
+	// meant to be reused across queries, so clearing only resets the ids that were actually hit
+	class hit_counter
+	{
+		std::vector<uint8_t> counts_;
+		std::vector<id_type> touched_;
+
+	public:
+		// makes sure ids below size can be counted
+		void reserve(size_t size)
+		{
+			if (counts_.size() < size)
+			{
+				counts_.resize(size);
+			}
+		}
+
+		void add(id_type id)
+		{
+			uint8_t& count = counts_[id];
+			if (count == 0)
+			{
+				touched_.push_back(id);
+			}
+			count += (count != UINT8_MAX);
+		}
+
+		uint8_t count(id_type id) const
+		{
+			return counts_[id];
+		}
+
+		// all ids with at least one hit, in the order they were first hit
+		const std::vector<id_type>& touched() const
+		{
+			return touched_;
+		}
+
+		void clear()
+		{
+			for (id_type id : touched_)
+			{
+				counts_[id] = 0;
+			}
+			touched_.clear();
+		}
+	};
+
 	// stores a name, and meta info of type T
 	template <typename T>
 	struct db_entry
@@ -192,7 +446,7 @@ namespace fuzzy
 	};
 
 	template <typename T>
-	using db_entry_reference = db_entry<T>*;
+	using db_entry_reference = const db_entry<T>*;
 
 	// represents a search result
 	// contains a reference to a database entry, along with a distance indicating similarity
@@ -225,18 +479,84 @@ namespace fuzzy
 	};
 
 	// a structured container for search results
-	// results are sorted by their distance, allowing for retrieval of best matches
+	// results are sorted by their distance, allowing for retrieval of best matches.
+	// a collection can be limited to what the caller is going to extract: at most max_count results,
+	// at most distance_range away from the best one, ranked by distance and then (if length_sort is set) by length.
+	// results beyond those limits are dropped as they come in, and threshold() tells searches what is still accepted
 	template <typename T>
 	class result_collection
 	{
-		std::map<int, result_list<T>> results_;
-		size_t size_ = 0;
+		// a max-heap, so the worst kept result is always at the front
+		std::vector<result<T>> results_;
+		int best_distance_ = INT_MAX;
+
+		size_t max_count_;
+		int distance_range_;
+		bool length_sort_;
+
+		// ties are broken by position in the database, which keeps the kept results deterministic
+		bool ranks_before(const result<T> &a, const result<T> &b) const
+		{
+			if (a.distance != b.distance)
+				return a.distance < b.distance;
+			if (length_sort_ && a.element->name.length() != b.element->name.length())
+				return a.element->name.length() < b.element->name.length();
+			return std::less<>{}(a.element, b.element);
+		}
+
+		auto rank_compare() const
+		{
+			return [this](const result<T> &a, const result<T> &b) { return ranks_before(a, b); };
+		}
+
+		result_list<T> sorted() const
+		{
+			result_list<T> sorted_results;
+			sorted_results.assign(results_.begin(), results_.end());
+			std::sort(sorted_results.begin(), sorted_results.end(), rank_compare());
+			return sorted_results;
+		}
 
 	public:
+		result_collection(size_t max_count = SIZE_MAX, int distance_range = INT_MAX, bool length_sort = false)
+			: max_count_(max_count), distance_range_(std::max(distance_range, 0)), length_sort_(length_sort)
+		{
+		}
+
+		// the largest distance a result can have and still make it into the collection
+		int threshold() const
+		{
+			if (max_count_ == 0)
+				return -1;
+			long bound = long(best_distance_) + distance_range_;
+			if (results_.size() >= max_count_)
+				bound = std::min<long>(bound, results_.front().distance);
+			return int(std::min<long>(bound, INT_MAX));
+		}
+
+		// whether add would keep the element
+		bool accepts(db_entry_reference<T> element, int distance) const
+		{
+			if (distance > threshold())
+				return false;
+			return results_.size() < max_count_ || ranks_before(result<T>(element, distance), results_.front());
+		}
+
 		void add(db_entry_reference<T> element, int distance)
 		{
-			results_[distance].emplace_back(element, distance);
-			++size_;
+			if (!accepts(element, distance))
+			{
+				return;
+			}
+			best_distance_ = std::min(best_distance_, distance);
+			results_.emplace_back(element, distance);
+			std::push_heap(results_.begin(), results_.end(), rank_compare());
+			// drop whatever can't be extracted anymore
+			while (results_.size() > max_count_ || long(results_.front().distance) > long(best_distance_) + distance_range_)
+			{
+				std::pop_heap(results_.begin(), results_.end(), rank_compare());
+				results_.pop_back();
+			}
 		}
 
 		bool empty() const
@@ -246,36 +566,39 @@ namespace fuzzy
 
 		size_t size() const
 		{
-			return size_;
+			return results_.size();
 		}
 
-		result_list<T> best()
+		// distance of the best result, INT_MAX while empty
+		int best_distance() const
 		{
-			return empty() ? result_list<T>{} : results_.begin()->second;
+			return best_distance_;
 		}
 
-		result_list<T> all()
+		result_list<T> best() const
 		{
-			result_list<T> extracted_results;
-			for (const auto &[result_distance, results_at_that_distance] : results_)
-			{
-				for (result<T> result : results_at_that_distance)
-				{
-					extracted_results.push_back(result);
-				}
-			}
-			return extracted_results;
+			result_list<T> best_results = sorted();
+			best_results.erase(std::find_if(best_results.begin(), best_results.end(),
+				[this](const result<T> &result) { return result.distance != best_distance_; }), best_results.end());
+			return best_results;
+		}
+
+		result_list<T> all() const
+		{
+			return sorted();
 		}
 
-		result_list<T> extract(uint32_t min_count, uint32_t max_count = UINT32_MAX, bool length_sort = false, int distance_range = INT_MAX, int max_distance = INT_MAX)
+		result_list<T> extract(uint32_t min_count, uint32_t max_count = UINT32_MAX, bool length_sort = false, int distance_range = INT_MAX, int max_distance = INT_MAX) const
 		{
+			result_list<T> sorted_results = sorted();
 			result_list<T> extracted_results;
-			long best_distance = INT_MAX;
-			for (const auto &[result_distance, results_at_that_distance] : results_)
+			for (auto band = sorted_results.begin(); band != sorted_results.end();)
 			{
-				best_distance = std::min(long(result_distance), best_distance);
+				const int result_distance = band->distance;
+				const auto band_end = std::find_if(band, sorted_results.end(),
+					[&](const result<T> &result) { return result.distance != result_distance; });
 
-				if (long(result_distance) > best_distance + long(distance_range) && extracted_results.size() >= min_count)
+				if (long(result_distance) > long(best_distance_) + long(distance_range) && extracted_results.size() >= min_count)
 				{
 					// we already have min_count results, and all further results are too far away from be best result
 					break;
@@ -286,13 +609,10 @@ namespace fuzzy
 					break;
 				}
 				const auto old_size = extracted_results.size();
-				for (result<T> result : results_at_that_distance)
-				{
-					extracted_results.push_back(result);
-				}
+				extracted_results.insert(extracted_results.end(), band, band_end);
 				if (length_sort)
 				{
-					std::sort(extracted_results.begin() + old_size, extracted_results.end(), result_list<T>::length_sort_func);
+					std::stable_sort(extracted_results.begin() + old_size, extracted_results.end(), result_list<T>::length_sort_func);
 				}
 				if (extracted_results.size() >= max_count)
 				{
@@ -300,274 +620,1451 @@ namespace fuzzy
 					extracted_results.erase(extracted_results.begin() + max_count, extracted_results.end());
 					break;
 				}
+				band = band_end;
 			}
 			return extracted_results;
 		}
 	};
 
-	template <typename T>
-	class database
+	// what a search did, for logging, metrics and tracing
+	struct query_stats
 	{
-	protected:
+		// set by the caller to time the stages. costs a few clock reads per visited name length
+		bool timed = false;
+
+		// distinct n-grams of the query, and how many of them have a bucket in the index
+		size_t tokens = 0;
+		size_t buckets = 0;
+		// ids read from the posting lists
+		size_t postings = 0;
+		// elements sharing an n-gram with the query, within the lengths that were visited.
+		// for a fuzzy completion search, the names within reach of the results
+		size_t candidates = 0;
+		// candidates whose distance to the query was computed
+		size_t verified = 0;
+		// candidates taken over from the last search of a typeahead session
+		size_t reused = 0;
+		// trie nodes a fuzzy completion search visited
+		size_t nodes = 0;
+
+		// stage timings in nanoseconds, only if timed is set: tokenizing the query and finding its buckets,
+		// counting shared n-grams, and computing distances
+		uint64_t lookup_time = 0;
+		uint64_t count_time = 0;
+		uint64_t verify_time = 0;
+	};
 
-		// groups element ids by name length
-		class element_bucket
+	// what a typeahead search leaves behind for the next keystroke, see database::typeahead_search
+	struct typeahead_state
+	{
+		std::string query;
+		// the threshold of the results, -1 if there is nothing to build on
+		int threshold = -1;
+		// the distinct n-grams of the query, sorted, and how many of its full-size n-grams are indexed
+		std::vector<ngram_token> tokens;
+		size_t indexed_ngrams = 0;
+		// the candidates within the threshold, with their distance
+		std::vector<std::pair<id_type, uint8_t>> matches;
+	};
+
+	// how long each phase of a database build took, in milliseconds
+	using build_timings = std::vector<std::pair<std::string, uint64_t>>;
+
+	namespace internal
+	{
+		inline unsigned build_threads()
 		{
-			// element count
-			uint64_t elements_ = 0;
-			// groups element ids by name length
-			std::map<uint16_t, std::vector<id_type>> data_;
+			return std::max(1u, std::thread::hardware_concurrency());
+		}
 
-		public:
-			void add(id_type id, uint16_t word_length)
-			{
-				data_[word_length].push_back(id);
-				++elements_;
-			}
-			std::map<uint16_t, std::vector<id_type>> &get()
+		// runs func(thread_index) on thread_count threads, the calling thread being thread 0
+		template <typename Func>
+		void run_parallel(unsigned thread_count, Func &&func)
+		{
+			std::vector<std::thread> workers;
+			for (unsigned thread_index = 1; thread_index < thread_count; thread_index++)
 			{
-				return data_;
+				workers.emplace_back([&func, thread_index] { func(thread_index); });
 			}
-			uint64_t size() const
+			func(0u);
+			for (auto &worker : workers)
 			{
-				return elements_;
+				worker.join();
 			}
-		};
-
-		// maps ngram tokens to element buckets
-		std::unordered_map<ngram_token, element_bucket> inverted_index_;
-		// all the database entries
-		std::vector<db_entry<T>> data_;
-
-		id_type id_counter_ = 0;
-		bool ready_ = false;
-
-		const struct {
-			const int ngram_size;
-			bool first_letter_opt;
-			uint64_t max_bucket_size;
-		} options_;
+		}
 
-		void add_to_index(const fuzzy::string& name, id_type id)
+		// the part of [0, count) that thread_index works on
+		inline std::pair<size_t, size_t> thread_range(size_t count, unsigned thread_index, unsigned thread_count)
 		{
-			const auto tokens = ngram_tokens(name, options_.ngram_size);
-			for (auto token : tokens)
-			{
-				inverted_index_[token].add(id, name.length());
-			}
+			return {count * thread_index / thread_count, count * (thread_index + 1) / thread_count};
 		}
 
-		void remove_overfull_buckets()
+		// sorts one run per thread, then merges neighbouring runs in parallel until one is left
+		template <typename Iter, typename Compare>
+		void parallel_sort(Iter first, Iter last, Compare compare, unsigned thread_count)
 		{
-			if (options_.max_bucket_size == UINT64_MAX)
+			const size_t count = last - first;
+			if (thread_count <= 1 || count < 2 * size_t(thread_count))
 			{
+				std::sort(first, last, compare);
 				return;
 			}
-			const auto max = options_.max_bucket_size;
-			std::erase_if(database<T>::inverted_index_,
-				[max](const std::pair<ngram_token, typename database<T>::element_bucket> &entry)
-				{ return entry.second.size() > max; });
-		}
-
-		std::unordered_map<id_type, uint8_t> potential_matches(const std::set<ngram_token>& query_token_set)
-		{
-			std::vector<element_bucket *> element_buckets;
-			for (auto token : query_token_set)
+			std::vector<size_t> bounds;
+			for (unsigned thread_index = 0; thread_index <= thread_count; thread_index++)
 			{
-				auto bucket = inverted_index_.find(token);
-				if (bucket != inverted_index_.end())
-				{
-					element_buckets.push_back(&bucket->second);
-				}
+				bounds.push_back(thread_range(count, thread_index, thread_count).first);
 			}
-			std::unordered_map<id_type, uint8_t> potential_matches;
-			for (element_bucket *element_bucket : element_buckets)
+			run_parallel(thread_count, [&](unsigned thread_index)
+				{ std::sort(first + bounds[thread_index], first + bounds[thread_index + 1], compare); });
+			for (unsigned width = 1; width < thread_count; width *= 2)
 			{
-				for (const auto& [length, id_list] : element_bucket->get())
+				run_parallel((thread_count + 2 * width - 1) / (2 * width), [&](unsigned merge_index)
 				{
-					for (id_type id : id_list)
+					const unsigned left = merge_index * 2 * width;
+					const unsigned middle = std::min(left + width, thread_count);
+					const unsigned right = std::min(left + 2 * width, thread_count);
+					if (middle < right)
 					{
-						potential_matches[id] += 1;
+						std::inplace_merge(first + bounds[left], first + bounds[middle], first + bounds[right], compare);
 					}
-				}
+				});
 			}
-			return potential_matches;
 		}
 
-		std::unordered_map<id_type, uint8_t> potential_matches(const std::vector<ngram_token>& query_tokens)
+		// measures consecutive phases of a build
+		class phase_timer
 		{
-			const std::set<ngram_token> query_token_set(query_tokens.begin(), query_tokens.end());
-			return potential_matches(query_token_set);
-		}
+			build_timings &timings_;
+			std::chrono::steady_clock::time_point start_ = std::chrono::steady_clock::now();
 
-		virtual void add(std::string_view name, T&& meta, id_type id)
-		{
-			if (name.empty())
+		public:
+			phase_timer(build_timings &timings)
+				: timings_(timings)
 			{
-				return;
 			}
-			const fuzzy::string internal_name = to_ngram_string(name);
-			
-			add_to_index(internal_name, id);
-			data_.resize(id + 1);
-			data_[id].name = std::move(internal_name);
-			data_[id].meta = meta;
-			ready_ = false;
-		}
-
-	public:
-		database(int ngram_size = 2, bool first_letter_opt = true, uint64_t max_bucket_size = UINT64_MAX)
-			: options_(ngram_size, first_letter_opt, max_bucket_size)
-		{
-		}
 
-		virtual void build()
-		{
-			remove_overfull_buckets();
-			ready_ = true;
-		}
+			void end_phase(const char *phase)
+			{
+				const auto now = std::chrono::steady_clock::now();
+				timings_.emplace_back(phase, std::chrono::duration_cast<std::chrono::milliseconds>(now - start_).count());
+				start_ = now;
+			}
+		};
 
-		void add(std::string_view name, T meta)
-		{
-			add(name, std::move(meta), id_counter_++);
-		}
-		void add(const char *name, T meta)
+		// measures consecutive stages of a search. a disabled clock never reads the time
+		class stage_clock
 		{
-			add(name, std::move(meta), id_counter_++);
-		}
+			const bool enabled_;
+			std::chrono::steady_clock::time_point start_;
 
-		virtual result_collection<T> fuzzy_search(const std::string& query, size_t truncate = 0)
-		{
-			if (!ready_)
+		public:
+			explicit stage_clock(bool enabled)
+				: enabled_(enabled)
 			{
-				build();
+				if (enabled_)
+					start_ = std::chrono::steady_clock::now();
 			}
 
-			// for an empty query, return an empty result
-			if (query.empty())
+			// adds the nanoseconds since the end of the last stage to total
+			void end_stage(uint64_t &total)
 			{
-				return result_collection<T>();
+				if (!enabled_)
+					return;
+				const auto now = std::chrono::steady_clock::now();
+				total += std::chrono::duration_cast<std::chrono::nanoseconds>(now - start_).count();
+				start_ = now;
 			}
+		};
+	}
 
-			const fuzzy::string query_internal = to_ngram_string(query);
-			const std::vector<ngram_token> query_tokens = ngram_tokens(query_internal, options_.ngram_size);
-			std::set<ngram_token> query_token_set(query_tokens.begin(), query_tokens.end());
-			const auto matches = potential_matches(query_token_set);
-
-			truncate = truncate ? truncate : SIZE_MAX;
-			result_collection<T> results;
-			for (auto [id, count] : matches)
+	namespace internal
+	{
+		// compressed posting lists store the differences between consecutive ids.
+		// full blocks of posting_block_size differences are bit packed with the block's largest bit width,
+		// the remaining ones are stored as varints
+		constexpr size_t posting_block_size = 128;
+		// packed blocks are interleaved over this many lanes, so unpacking vectorizes
+		constexpr size_t posting_block_lanes = 4;
+
+		inline void append_varint(std::vector<uint8_t> &out, uint32_t value)
+		{
+			while (value >= 0x80)
 			{
-				// to speed things up, ignore words that dont start with the same letter
-				if (options_.first_letter_opt && query_internal[0] != data_[id].name[0])
-				{
-					continue;
-				}
-				results.add(&data_[id],	osa_distance(query_internal,
-					fuzzy::string_view(data_[id].name.c_str(), std::min(data_[id].name.length(), truncate))));
+				out.push_back(uint8_t(value) | 0x80);
+				value >>= 7;
 			}
-			return results;
+			out.push_back(uint8_t(value));
 		}
-	};
-
-	template <typename T>
-	class sorted_database : public database<T>
-	{
-	protected:
 
-		const struct {
-			size_t result_limit;
-		} options_;
-
-
-		void add(std::string_view name, T&& meta, id_type id) override
+		inline const uint8_t *read_varint(const uint8_t *in, uint32_t &value)
 		{
-			assert(!database<T>::ready_ || !"Inserting into a sorted database rebuilds everything, so dont do it.");
-			if (name.empty())
+			value = 0;
+			for (int shift = 0;; shift += 7)
 			{
-				return;
+				const uint8_t byte = *in++;
+				value |= uint32_t(byte & 0x7f) << shift;
+				if (!(byte & 0x80))
+					return in;
 			}
-			const fuzzy::string internal_name = internal::to_ngram_string(name);
-			database<T>::ready_ = false;
-			database<T>::data_.resize(id + 1);
-			database<T>::data_[id].name = std::move(internal_name);
-			database<T>::data_[id].meta = meta;
 		}
 
-		result_collection<T> extract_page(std::pair<typename std::vector<db_entry<T>>::iterator, typename std::vector<db_entry<T>>::iterator> range, size_t page_number, size_t page_size)
+		// packs posting_block_size values: one byte holding the bit width,
+		// followed by bit width many words per lane. value i goes to lane i % posting_block_lanes
+		inline void pack_block(std::vector<uint8_t> &out, const uint32_t *values)
 		{
-			if (page_size == 0)
+			uint32_t all_bits = 0;
+			for (size_t i = 0; i < posting_block_size; i++)
+				all_bits |= values[i];
+			const int bits = all_bits ? 32 - __builtin_clz(all_bits) : 0;
+			out.push_back(uint8_t(bits));
+
+			uint32_t words[32 * posting_block_lanes] = {};
+			for (size_t i = 0; i < posting_block_size; i++)
 			{
-				page_size = SIZE_MAX;
-				page_number = 0;
+				const size_t lane = i % posting_block_lanes;
+				const size_t bit = (i / posting_block_lanes) * bits;
+				words[(bit / 32) * posting_block_lanes + lane] |= values[i] << (bit % 32);
+				if (bit % 32 + bits > 32)
+					words[(bit / 32 + 1) * posting_block_lanes + lane] |= values[i] >> (32 - bit % 32);
 			}
-			page_size = std::min<size_t>(page_size, options_.result_limit);
+			const size_t size = bits * posting_block_lanes * sizeof(uint32_t);
+			out.insert(out.end(), (const uint8_t *)words, (const uint8_t *)words + size);
+		}
 
-			result_collection<T> results;
-			size_t start_index = page_number * page_size;
-			size_t end_index = start_index + page_size;
-			if (size_t(range.second - range.first) < start_index)
+		inline const uint8_t *unpack_block(const uint8_t *in, uint32_t *values)
+		{
+			const int bits = *in++;
+			if (bits == 0)
 			{
-				return results;
+				std::fill_n(values, posting_block_size, 0);
+				return in;
 			}
-			auto start_iter = range.first + start_index;
-			auto end_iter = (size_t(range.second - range.first) < end_index) ? range.second : range.first + end_index;
-			for (auto iter = start_iter; iter != end_iter; ++iter)
+			uint32_t words[(32 + 1) * posting_block_lanes] = {};
+			std::memcpy(words, in, bits * posting_block_lanes * sizeof(uint32_t));
+			const uint32_t mask = bits == 32 ? UINT32_MAX : (uint32_t(1) << bits) - 1;
+			for (size_t i = 0; i < posting_block_size / posting_block_lanes; i++)
 			{
-				results.add(&(*iter), 0);
+				const size_t bit = i * bits;
+				const uint32_t *low = words + (bit / 32) * posting_block_lanes;
+				const uint32_t *high = low + posting_block_lanes;
+				const int shift = bit % 32;
+				// the same operations on every lane
+				for (size_t lane = 0; lane < posting_block_lanes; lane++)
+				{
+					const uint32_t spill = shift ? uint32_t(uint64_t(high[lane]) << (32 - shift)) : 0;
+					values[i * posting_block_lanes + lane] = ((low[lane] >> shift) | spill) & mask;
+				}
 			}
-			return results;
+			return in + bits * posting_block_lanes * sizeof(uint32_t);
 		}
+	}
 
-	public:
-		using database<T>::add;
-
-		sorted_database(int ngram_size = 2, size_t result_limit = 100, bool first_letter_opt = true, uint64_t max_bucket_size = UINT64_MAX)
-			: database<T>(ngram_size, first_letter_opt, max_bucket_size), options_(result_limit)
-		{}
-
-		void build() override
+	namespace internal
+	{
+		// writes trivially copyable values, and arrays of them, in native byte order
+		class snapshot_writer
 		{
-			// sort data
-			std::sort(
-				database<T>::data_.begin(), database<T>::data_.end(),
-				[](const db_entry<T> &a, const db_entry<T> &b)
-				{ return string_compare(a.name, b.name); });
+			std::ostream &out_;
 
-			// build inverted index
-			database<T>::inverted_index_.clear();
-			for (size_t id = 0; id < database<T>::data_.size(); id++)
+		public:
+			explicit snapshot_writer(std::ostream &out)
+				: out_(out)
 			{
-				database<T>::add_to_index(database<T>::data_[id].name, id);
 			}
 
-			database<T>::remove_overfull_buckets();
+			template <typename V>
+			void write(const V &value)
+			{
+				static_assert(std::is_trivially_copyable_v<V>);
+				out_.write(reinterpret_cast<const char *>(&value), sizeof(V));
+			}
 
-			database<T>::ready_ = true;
-		}
+			template <typename Range>
+			void write_array(const Range &values)
+			{
+				using V = std::ranges::range_value_t<Range>;
+				static_assert(std::is_trivially_copyable_v<V>);
+				write<uint64_t>(std::ranges::size(values));
+				out_.write(reinterpret_cast<const char *>(std::ranges::data(values)), std::ranges::size(values) * sizeof(V));
+			}
+		};
 
-		result_collection<T> exact_search(const std::string& query, size_t page_number = 0, size_t page_size = 0)
+		// reads what a snapshot_writer wrote. reading past the end makes the reader fail instead
+		class snapshot_reader
 		{
-			if (!database<T>::ready_)
+			const char *pos_;
+			const char *end_;
+			bool good_ = true;
+
+		public:
+			explicit snapshot_reader(std::span<const char> data)
+				: pos_(data.data()), end_(data.data() + data.size())
 			{
-				build();
 			}
-			const fuzzy::string query_internal = internal::to_ngram_string(query);
-			auto range = std::ranges::equal_range(
-				database<T>::data_, db_entry<T>{query_internal, T{}},
-				[](const db_entry<T> &a, const db_entry<T> &b)
-				{ return string_compare(a.name, b.name); });
-			return extract_page(range, page_number, page_size);
+
+			template <typename V>
+			V read()
+			{
+				static_assert(std::is_trivially_copyable_v<V>);
+				V value{};
+				if (size_t(end_ - pos_) < sizeof(V))
+				{
+					good_ = false;
+					pos_ = end_;
+					return value;
+				}
+				std::memcpy(&value, pos_, sizeof(V));
+				pos_ += sizeof(V);
+				return value;
+			}
+
+			template <typename V>
+			std::vector<V> read_array()
+			{
+				static_assert(std::is_trivially_copyable_v<V>);
+				const uint64_t count = read<uint64_t>();
+				if (count > size_t(end_ - pos_) / sizeof(V))
+				{
+					good_ = false;
+					pos_ = end_;
+					return {};
+				}
+				std::vector<V> values(count);
+				if (count > 0)
+					std::memcpy(values.data(), pos_, count * sizeof(V));
+				pos_ += count * sizeof(V);
+				return values;
+			}
+
+			// a view of an array in the snapshot, for arrays that are only read once while loading,
+			// so they don't need a copy. the values may be unaligned, so they are copied out one at a time
+			template <typename V>
+			class array_view
+			{
+				const char *data_ = nullptr;
+				size_t size_ = 0;
+
+			public:
+				array_view() = default;
+				array_view(const char *data, size_t size)
+					: data_(data), size_(size)
+				{
+				}
+
+				size_t size() const
+				{
+					return size_;
+				}
+
+				V operator[](size_t index) const
+				{
+					V value;
+					std::memcpy(&value, data_ + index * sizeof(V), sizeof(V));
+					return value;
+				}
+
+				// the values themselves, for types that need no alignment
+				const V *data() const
+				{
+					static_assert(alignof(V) == 1);
+					return reinterpret_cast<const V *>(data_);
+				}
+			};
+
+			template <typename V>
+			array_view<V> read_array_view()
+			{
+				static_assert(std::is_trivially_copyable_v<V>);
+				const uint64_t count = read<uint64_t>();
+				if (count > size_t(end_ - pos_) / sizeof(V))
+				{
+					good_ = false;
+					pos_ = end_;
+					return {};
+				}
+				const array_view<V> values(pos_, count);
+				pos_ += count * sizeof(V);
+				return values;
+			}
+
+			// whether all reads so far were in bounds
+			bool good() const
+			{
+				return good_;
+			}
+		};
+	}
+
+	// an inverted index from ngram tokens to element ids, in a compressed sparse row layout:
+	// a sorted token array, the offsets of each token's length groups, and one contiguous posting array
+	// ordered by (token, name length, id). it is built at once from all entries and immutable afterwards.
+	// the postings are either plain ids, or compressed as described above
+	class posting_index
+	{
+	public:
+		// written to snapshots as is, so it has no padding that could differ between runs
+		struct length_group
+		{
+			uint16_t word_length;
+			uint16_t unused = 0;
+			// number of ids in the group
+			uint32_t count;
+			// offset of the group's first posting. the group ends where the next one begins
+			uint64_t first;
+		};
+
+		// the ids of all elements containing a specific token, grouped by name length
+		class element_bucket
+		{
+			std::span<const length_group> groups_;
+			const id_type *ids_;
+			const uint8_t *packed_;
+
+		public:
+			element_bucket(std::span<const length_group> groups, const id_type *ids, const uint8_t *packed)
+				: groups_(groups), ids_(ids), packed_(packed)
+			{
+			}
+			// the length groups, sorted by name length
+			std::span<const length_group> groups() const
+			{
+				return groups_;
+			}
+			// the group of all elements with the given name length, or nullptr if there are none
+			const length_group *find(uint16_t word_length) const
+			{
+				const auto group = std::ranges::lower_bound(groups_, word_length, {}, &length_group::word_length);
+				if (group == groups_.end() || group->word_length != word_length)
+				{
+					return nullptr;
+				}
+				return &*group;
+			}
+			// calls func with every id of the group, in ascending order
+			template <typename Func>
+			void for_each(const length_group &group, Func &&func) const
+			{
+				if (ids_)
+				{
+					for (id_type id : std::span<const id_type>(ids_ + group.first, group.count))
+					{
+						func(id);
+					}
+					return;
+				}
+				const uint8_t *in = packed_ + group.first;
+				id_type id = 0;
+				uint32_t remaining = group.count;
+				uint32_t deltas[posting_block_size];
+				for (; remaining >= posting_block_size; remaining -= posting_block_size)
+				{
+					in = unpack_block(in, deltas);
+					for (uint32_t delta : deltas)
+					{
+						func(id += delta);
+					}
+				}
+				for (; remaining > 0; remaining--)
+				{
+					uint32_t delta;
+					in = read_varint(in, delta);
+					func(id += delta);
+				}
+			}
+		};
+
+	private:
+		std::vector<ngram_token> tokens_;
+		// tokens_.size() + 1 offsets into groups_
+		std::vector<uint32_t> token_groups_;
+		// ends with a sentinel group marking the end of the postings
+		std::vector<length_group> groups_;
+		// plain postings
+		std::vector<id_type> ids_;
+		// compressed postings
+		std::vector<uint8_t> packed_;
+		bool compressed_ = false;
+		// ids decoded per microsecond, measured after building or loading compressed postings
+		double decode_rate_ = 0;
+
+		static uint64_t group_key(ngram_token token, uint16_t word_length)
+		{
+			return uint64_t(token) << 16 | word_length;
+		}
+
+		// groups are encoded independently, so every thread encodes a range of them
+		// and the encoded ranges are concatenated afterwards
+		void compress(unsigned thread_count)
+		{
+			std::vector<std::vector<uint8_t>> parts(thread_count);
+			run_parallel(thread_count, [&](unsigned thread_index)
+			{
+				const auto [first_group, last_group] = thread_range(groups_.size(), thread_index, thread_count);
+				std::vector<uint8_t> &packed = parts[thread_index];
+				std::vector<uint32_t> deltas;
+				for (size_t index = first_group; index < last_group; index++)
+				{
+					length_group &group = groups_[index];
+					const uint64_t first = std::exchange(group.first, packed.size());
+					deltas.resize(group.count);
+					for (uint32_t i = 0; i < group.count; i++)
+					{
+						deltas[i] = ids_[first + i] - (i ? ids_[first + i - 1] : 0);
+					}
+					size_t i = 0;
+					for (; i + posting_block_size <= deltas.size(); i += posting_block_size)
+					{
+						pack_block(packed, deltas.data() + i);
+					}
+					for (; i < deltas.size(); i++)
+					{
+						append_varint(packed, deltas[i]);
+					}
+				}
+			});
+
+			std::vector<uint8_t> packed;
+			for (unsigned thread_index = 0; thread_index < thread_count; thread_index++)
+			{
+				const auto [first_group, last_group] = thread_range(groups_.size(), thread_index, thread_count);
+				for (size_t index = first_group; index < last_group; index++)
+				{
+					groups_[index].first += packed.size();
+				}
+				packed.insert(packed.end(), parts[thread_index].begin(), parts[thread_index].end());
+				parts[thread_index] = std::vector<uint8_t>();
+			}
+			packed.shrink_to_fit();
+			packed_ = std::move(packed);
+			ids_ = std::vector<id_type>();
+		}
+
+		// whether a group of a loaded index stays within its part of the postings, which ends at end,
+		// and only holds ids of existing elements. compressed groups are decoded for it
+		bool consistent_group(const length_group &group, uint64_t end, size_t element_count) const
+		{
+			if (group.count == 0 || group.first > end || end > (compressed_ ? packed_.size() : ids_.size()))
+			{
+				return false;
+			}
+			if (!compressed_)
+			{
+				const std::span<const id_type> ids(ids_.data() + group.first, end - group.first);
+				return ids.size() == group.count && std::ranges::is_sorted(ids) && ids.back() < element_count;
+			}
+			const uint8_t *in = packed_.data() + group.first;
+			const uint8_t *const group_end = packed_.data() + end;
+			uint64_t id = 0;
+			uint32_t remaining = group.count;
+			uint32_t deltas[posting_block_size];
+			for (; remaining >= posting_block_size; remaining -= posting_block_size)
+			{
+				if (in == group_end || *in > 32 || size_t(group_end - in) < 1 + *in * posting_block_lanes * sizeof(uint32_t))
+				{
+					return false;
+				}
+				in = unpack_block(in, deltas);
+				for (uint32_t delta : deltas)
+				{
+					id += delta;
+				}
+			}
+			for (; remaining > 0; remaining--)
+			{
+				uint32_t delta = 0;
+				for (int shift = 0;; shift += 7)
+				{
+					// a varint of 32 bits takes at most 5 bytes
+					if (in == group_end || shift > 28)
+					{
+						return false;
+					}
+					const uint8_t byte = *in++;
+					delta |= uint32_t(byte & 0x7f) << shift;
+					if (!(byte & 0x80))
+						break;
+				}
+				id += delta;
+			}
+			// the ids ascend, so the last one is the largest
+			return in == group_end && id < element_count;
+		}
+
+		// whether a loaded index is one that build could have made for element_count elements,
+		// so searches on it stay in bounds. the groups are checked in parallel
+		bool consistent(size_t element_count, unsigned thread_count = build_threads()) const
+		{
+			if (groups_.empty() || token_groups_.size() != tokens_.size() + 1 || token_groups_.front() != 0
+				|| token_groups_.back() != groups_.size() - 1
+				|| groups_.back().first != (compressed_ ? packed_.size() : ids_.size()))
+			{
+				return false;
+			}
+			for (size_t index = 0; index < tokens_.size(); index++)
+			{
+				// every token has at least one group
+				if ((index > 0 && tokens_[index - 1] >= tokens_[index]) || token_groups_[index] >= token_groups_[index + 1])
+				{
+					return false;
+				}
+			}
+			for (size_t index = 0; index < tokens_.size(); index++)
+			{
+				for (size_t group = token_groups_[index] + 1; group < token_groups_[index + 1]; group++)
+				{
+					if (groups_[group - 1].word_length >= groups_[group].word_length)
+					{
+						return false;
+					}
+				}
+			}
+			std::atomic_bool consistent = true;
+			run_parallel(thread_count, [&](unsigned thread_index)
+			{
+				const auto [first_group, last_group] = thread_range(groups_.size() - 1, thread_index, thread_count);
+				for (size_t index = first_group; index < last_group && consistent; index++)
+				{
+					if (!consistent_group(groups_[index], groups_[index + 1].first, element_count))
+					{
+						consistent = false;
+					}
+				}
+			});
+			return consistent;
+		}
+
+		// decodes a sample of evenly spread lists, so startup and reloads don't pay for a pass over all postings
+		void measure_decode_rate()
+		{
+			constexpr size_t max_sampled_tokens = 1024;
+			constexpr uint64_t max_sampled_ids = 1 << 20;
+			const size_t step = std::max<size_t>(1, tokens_.size() / max_sampled_tokens);
+			const auto start = std::chrono::steady_clock::now();
+			uint64_t checksum = 0, count = 0;
+			for (size_t index = 0; index < tokens_.size() && count < max_sampled_ids; index += step)
+			{
+				const element_bucket bucket = *find(tokens_[index]);
+				for (const auto &group : bucket.groups())
+				{
+					bucket.for_each(group, [&](id_type id) { checksum += id; });
+					count += group.count;
+				}
+			}
+			const auto microseconds = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+			volatile uint64_t sink = checksum;
+			(void)sink;
+			decode_rate_ = count / std::max(microseconds, 1.0);
+		}
+
+	public:
+		// indexes the names of all entries, using their position as id.
+		// tokens with more than max_bucket_size postings are left out.
+		// every thread handles a contiguous range of ids, and its postings go after those
+		// of the threads before it, so the ids of each group still end up sorted
+		template <typename Entries>
+		void build(const Entries &entries, int ngram_size, uint64_t max_bucket_size, bool compressed, build_timings &timings,
+			unsigned thread_count = build_threads())
+		{
+			phase_timer timer(timings);
+
+			// every thread counts the postings of each (token, length) group in its id range.
+			// the counts are split into one shard per thread by key, so the shards can be merged in parallel
+			using group_map = std::unordered_map<uint64_t, uint64_t>;
+			const auto shard_of = [thread_count](uint64_t key)
+			{
+				return unsigned((key * 0x9E3779B97F4A7C15) >> 32) % thread_count;
+			};
+			std::vector<std::vector<group_map>> thread_groups(thread_count, std::vector<group_map>(thread_count));
+			run_parallel(thread_count, [&](unsigned thread_index)
+			{
+				const auto [first_id, last_id] = thread_range(entries.size(), thread_index, thread_count);
+				for (size_t id = first_id; id < last_id; id++)
+				{
+					for (auto token : ngram_tokens(entries[id].name, ngram_size))
+					{
+						const uint64_t key = group_key(token, uint16_t(entries[id].name.length()));
+						++thread_groups[thread_index][shard_of(key)][key];
+					}
+				}
+			});
+			std::vector<std::vector<std::pair<uint64_t, uint64_t>>> shard_sizes(thread_count);
+			run_parallel(thread_count, [&](unsigned shard)
+			{
+				group_map sizes;
+				for (const auto &groups : thread_groups)
+				{
+					for (const auto &[key, size] : groups[shard])
+					{
+						sizes[key] += size;
+					}
+				}
+				shard_sizes[shard].assign(sizes.begin(), sizes.end());
+			});
+			std::vector<std::pair<uint64_t, uint64_t>> group_sizes;
+			for (auto &sizes : shard_sizes)
+			{
+				group_sizes.insert(group_sizes.end(), sizes.begin(), sizes.end());
+				sizes = {};
+			}
+			parallel_sort(group_sizes.begin(), group_sizes.end(), std::less<>{}, thread_count);
+			timer.end_phase("count postings");
+
+			// lay out the groups, skipping tokens with too many postings.
+			// cursors holds the offset of every counted group, or UINT64_MAX if it was skipped
+			tokens_.clear();
+			token_groups_.clear();
+			groups_.clear();
+			groups_.reserve(group_sizes.size() + 1);
+			std::vector<uint64_t> cursors(group_sizes.size(), UINT64_MAX);
+			uint64_t offset = 0;
+			for (size_t first = 0, last = 0; first < group_sizes.size(); first = last)
+			{
+				const ngram_token token = ngram_token(group_sizes[first].first >> 16);
+				uint64_t token_size = 0;
+				for (; last < group_sizes.size() && ngram_token(group_sizes[last].first >> 16) == token; last++)
+				{
+					token_size += group_sizes[last].second;
+				}
+				if (token_size > max_bucket_size)
+				{
+					continue;
+				}
+				tokens_.push_back(token);
+				token_groups_.push_back(groups_.size());
+				for (size_t index = first; index < last; index++)
+				{
+					groups_.push_back({.word_length = uint16_t(group_sizes[index].first), .count = uint32_t(group_sizes[index].second), .first = offset});
+					cursors[index] = offset;
+					offset += group_sizes[index].second;
+				}
+			}
+			token_groups_.push_back(groups_.size());
+			groups_.push_back({.word_length = 0, .count = 0, .first = offset});
+
+			// turn the per-thread counts into per-thread insertion cursors, in thread order.
+			// a group only lives in one shard, so its cursor is only advanced by one thread
+			run_parallel(thread_count, [&](unsigned shard)
+			{
+				for (auto &groups : thread_groups)
+				{
+					for (auto &[key, size] : groups[shard])
+					{
+						const size_t index = std::lower_bound(group_sizes.begin(), group_sizes.end(), std::make_pair(key, uint64_t(0))) - group_sizes.begin();
+						if (cursors[index] == UINT64_MAX)
+						{
+							size = UINT64_MAX;
+							continue;
+						}
+						size = std::exchange(cursors[index], cursors[index] + size);
+					}
+				}
+			});
+			timer.end_phase("lay out groups");
+
+			// fill in the ids
+			ids_.resize(offset);
+			ids_.shrink_to_fit();
+			packed_.clear();
+			run_parallel(thread_count, [&](unsigned thread_index)
+			{
+				const auto [first_id, last_id] = thread_range(entries.size(), thread_index, thread_count);
+				for (size_t id = first_id; id < last_id; id++)
+				{
+					for (auto token : ngram_tokens(entries[id].name, ngram_size))
+					{
+						const uint64_t key = group_key(token, uint16_t(entries[id].name.length()));
+						uint64_t &cursor = thread_groups[thread_index][shard_of(key)].find(key)->second;
+						if (cursor != UINT64_MAX)
+						{
+							ids_[cursor++] = id;
+						}
+					}
+				}
+			});
+			thread_groups.clear();
+			timer.end_phase("fill postings");
+
+			compressed_ = compressed;
+			if (compressed_)
+			{
+				compress(thread_count);
+				timer.end_phase("compress postings");
+				measure_decode_rate();
+				timer.end_phase("measure decode rate");
+			}
+		}
+
+		void save(snapshot_writer &writer) const
+		{
+			writer.write(compressed_);
+			writer.write_array(tokens_);
+			writer.write_array(token_groups_);
+			writer.write_array(groups_);
+			writer.write_array(ids_);
+			writer.write_array(packed_);
+		}
+
+		// returns false, leaving the index untouched, if the snapshot is truncated or inconsistent
+		// with an index over element_count elements
+		bool load(snapshot_reader &reader, size_t element_count)
+		{
+			posting_index loaded;
+			loaded.compressed_ = reader.read<bool>();
+			loaded.tokens_ = reader.read_array<ngram_token>();
+			loaded.token_groups_ = reader.read_array<uint32_t>();
+			loaded.groups_ = reader.read_array<length_group>();
+			loaded.ids_ = reader.read_array<id_type>();
+			loaded.packed_ = reader.read_array<uint8_t>();
+			if (!reader.good() || !loaded.consistent(element_count))
+			{
+				return false;
+			}
+			// the rate depends on the machine, so it isn't part of the snapshot
+			if (loaded.compressed_)
+			{
+				loaded.measure_decode_rate();
+			}
+			*this = std::move(loaded);
+			return true;
+		}
+
+		bool contains(ngram_token token) const
+		{
+			return std::binary_search(tokens_.begin(), tokens_.end(), token);
+		}
+
+		std::optional<element_bucket> find(ngram_token token) const
+		{
+			const auto iter = std::lower_bound(tokens_.begin(), tokens_.end(), token);
+			if (iter == tokens_.end() || *iter != token)
+			{
+				return std::nullopt;
+			}
+			const size_t index = iter - tokens_.begin();
+			const auto first_group = groups_.begin() + token_groups_[index];
+			const auto last_group = groups_.begin() + token_groups_[index + 1];
+			return element_bucket(std::span<const length_group>(first_group, last_group),
+				compressed_ ? nullptr : ids_.data(), packed_.data());
+		}
+
+		size_t token_count() const
+		{
+			return tokens_.size();
+		}
+
+		size_t posting_count() const
+		{
+			size_t count = 0;
+			for (const auto &group : groups_)
+			{
+				count += group.count;
+			}
+			return count;
+		}
+
+		bool compressed() const
+		{
+			return compressed_;
+		}
+
+		// approximate heap memory used by the index, in bytes
+		size_t memory_usage() const
+		{
+			return tokens_.capacity() * sizeof(ngram_token) + token_groups_.capacity() * sizeof(uint32_t)
+				+ groups_.capacity() * sizeof(length_group) + ids_.capacity() * sizeof(id_type) + packed_.capacity();
+		}
+
+		// ids decoded per microsecond when scanning compressed postings, 0 if they are plain
+		double decode_rate() const
+		{
+			return decode_rate_;
+		}
+	};
+
+	// entries are added and built first. once built, the database is frozen:
+	// queries are const, never trigger a build, and may run concurrently.
+	// adding entries afterwards needs another build, which must not overlap with queries
+	template <typename T>
+	class database
+	{
+	protected:
+
+		using element_bucket = posting_index::element_bucket;
+
+		// maps ngram tokens to element buckets
+		posting_index inverted_index_;
+		// all the database entries
+		std::vector<db_entry<T>> data_;
+
+		id_type id_counter_ = 0;
+		bool ready_ = false;
+
+		const struct {
+			const int ngram_size;
+			bool first_letter_opt;
+			uint64_t max_bucket_size;
+			bool compressed_postings;
+		} options_;
+
+		// how long the phases of the last build took
+		build_timings build_timings_;
+
+		void build_index()
+		{
+			inverted_index_.build(data_, options_.ngram_size, options_.max_bucket_size, options_.compressed_postings, build_timings_);
+		}
+
+		// the buckets of all query tokens that are in the index
+		std::vector<element_bucket> query_buckets(const std::set<ngram_token>& query_token_set) const
+		{
+			std::vector<element_bucket> element_buckets;
+			for (auto token : query_token_set)
+			{
+				if (auto bucket = inverted_index_.find(token))
+				{
+					element_buckets.push_back(*bucket);
+				}
+			}
+			return element_buckets;
+		}
+
+		// counts the query tokens each element with the given name length shares with the query.
+		// returns the number of postings read
+		static size_t potential_matches(const std::vector<element_bucket>& element_buckets, uint16_t word_length, hit_counter& counter)
+		{
+			size_t postings = 0;
+			for (const element_bucket &element_bucket : element_buckets)
+			{
+				if (const auto *group = element_bucket.find(word_length))
+				{
+					element_bucket.for_each(*group, [&](id_type id) { counter.add(id); });
+					postings += group->count;
+				}
+			}
+			return postings;
+		}
+
+		virtual void add(std::string_view name, T&& meta, id_type id)
+		{
+			if (name.empty())
+			{
+				return;
+			}
+			const fuzzy::string internal_name = to_ngram_string(name);
+			data_.resize(id + 1);
+			data_[id].name = std::move(internal_name);
+			data_[id].meta = meta;
+			ready_ = false;
+		}
+
+	public:
+		database(int ngram_size = 2, bool first_letter_opt = true, uint64_t max_bucket_size = UINT64_MAX, bool compressed_postings = false)
+			: options_(ngram_size, first_letter_opt, max_bucket_size, compressed_postings)
+		{
+		}
+
+		const posting_index &index() const
+		{
+			return inverted_index_;
+		}
+
+		bool ready() const
+		{
+			return ready_;
+		}
+
+		const build_timings &last_build_timings() const
+		{
+			return build_timings_;
+		}
+
+		size_t size() const
+		{
+			return data_.size();
+		}
+
+		// writes the built database. entry metadata is copied bytewise, so T has to be trivially copyable
+		// T is written byte for byte, so it should have no padding, or snapshots of the same data differ
+		void save(snapshot_writer &writer) const
+		{
+			static_assert(std::is_trivially_copyable_v<T>);
+			assert(ready_);
+			writer.write(options_.ngram_size);
+			writer.write(options_.max_bucket_size);
+			writer.write(options_.compressed_postings);
+
+			fuzzy::string names;
+			std::vector<uint32_t> name_lengths;
+			std::vector<T> metas;
+			name_lengths.reserve(data_.size());
+			metas.reserve(data_.size());
+			for (const auto &entry : data_)
+			{
+				names += entry.name;
+				name_lengths.push_back(entry.name.size());
+				metas.push_back(entry.meta);
+			}
+			writer.write_array(names);
+			writer.write_array(name_lengths);
+			writer.write_array(metas);
+			writer.write(id_counter_);
+			inverted_index_.save(writer);
+		}
+
+		// loads a database written by save. returns false, leaving the database untouched,
+		// if the snapshot is malformed or was built with different options
+		virtual bool load(snapshot_reader &reader)
+		{
+			static_assert(std::is_trivially_copyable_v<T>);
+			if (reader.read<int>() != options_.ngram_size || reader.read<uint64_t>() != options_.max_bucket_size
+				|| reader.read<bool>() != options_.compressed_postings)
+			{
+				return false;
+			}
+			// the names and metas go straight from the snapshot into the entries
+			const auto names = reader.read_array_view<ngram_char>();
+			const auto name_lengths = reader.read_array_view<uint32_t>();
+			const auto metas = reader.read_array_view<T>();
+			const id_type id_counter = reader.read<id_type>();
+			if (!reader.good() || name_lengths.size() != metas.size())
+			{
+				return false;
+			}
+			std::vector<db_entry<T>> data(metas.size());
+			size_t offset = 0;
+			for (size_t i = 0; i < data.size(); i++)
+			{
+				if (name_lengths[i] > names.size() - offset)
+				{
+					return false;
+				}
+				data[i].name.assign(names.data() + offset, name_lengths[i]);
+				data[i].meta = metas[i];
+				offset += name_lengths[i];
+			}
+			if (!inverted_index_.load(reader, data.size()))
+			{
+				return false;
+			}
+			data_ = std::move(data);
+			id_counter_ = id_counter;
+			build_timings_.clear();
+			ready_ = true;
+			return true;
+		}
+
+		virtual void build()
+		{
+			build_timings_.clear();
+			build_index();
+			ready_ = true;
+		}
+
+		// empty names are skipped without using up an id, so data_ has no gaps
+		void add(std::string_view name, T meta)
+		{
+			if (!name.empty())
+				add(name, std::move(meta), id_counter_++);
+		}
+		void add(const char *name, T meta)
+		{
+			add(std::string_view(name), std::move(meta));
+		}
+
+	protected:
+		// typeahead sessions with more candidates within reach than this start over on every keystroke
+		static constexpr size_t max_typeahead_matches = 1 << 12;
+
+		// the search behind fuzzy_search and typeahead_search. if previous is set, the query extends its query
+		// (see typeahead_search), and only names that could still be in reach are looked at.
+		// if next is set, it is filled for the next keystroke
+		result_collection<T> search(const std::string& query, size_t truncate, result_collection<T> results, query_stats *stats,
+			const typeahead_state *previous, typeahead_state *next) const
+		{
+			assert(ready_ || !"Build the database before searching it.");
+
+			// for an empty query, return an empty result
+			if (query.empty())
+			{
+				return results;
+			}
+
+			query_stats unused_stats;
+			query_stats &search_stats = stats ? *stats : unused_stats;
+			internal::stage_clock clock(search_stats.timed);
+
+			const fuzzy::string query_internal = to_ngram_string(query);
+			const std::vector<ngram_token> query_tokens = ngram_tokens(query_internal, options_.ngram_size);
+			std::set<ngram_token> query_token_set(query_tokens.begin(), query_tokens.end());
+			const auto element_buckets = query_buckets(query_token_set);
+
+			// ngram_tokens puts the ngrams of the configured size first. shorter ones are only indexed for short names,
+			// so only the full-size ngrams that made it into the index count towards the q-gram filter
+			const size_t full_size_ngrams = query_internal.length() + 1 - std::min<size_t>(query_internal.length() + 1, options_.ngram_size);
+			const std::set<ngram_token> indexed_ngrams = [&]
+			{
+				std::set<ngram_token> tokens;
+				for (size_t i = 0; i < full_size_ngrams; i++)
+				{
+					if (inverted_index_.contains(query_tokens[i]))
+						tokens.insert(query_tokens[i]);
+				}
+				return tokens;
+			}();
+
+			truncate = truncate ? truncate : SIZE_MAX;
+
+			// the length difference is a lower bound for the distance, so the name lengths
+			// are visited in order of that bound, and only as long as the bound can still be met
+			const auto length_bound = [&](uint16_t word_length)
+			{
+				return std::abs(long(std::min<size_t>(word_length, truncate)) - long(query_internal.length()));
+			};
+			std::vector<uint16_t> word_lengths;
+			for (const element_bucket &element_bucket : element_buckets)
+			{
+				for (const auto &group : element_bucket.groups())
+				{
+					word_lengths.push_back(group.word_length);
+				}
+			}
+			std::sort(word_lengths.begin(), word_lengths.end(), [&](uint16_t a, uint16_t b)
+				{ return std::make_pair(length_bound(a), a) < std::make_pair(length_bound(b), b); });
+			word_lengths.erase(std::unique(word_lengths.begin(), word_lengths.end()), word_lengths.end());
+
+			static thread_local hit_counter matches;
+			matches.clear();
+			matches.reserve(data_.size());
+			clock.end_stage(search_stats.lookup_time);
+
+			const osa_matcher matcher(query_internal);
+			size_t postings = 0;
+			size_t verified = 0;
+			size_t reused = 0;
+			auto verify_distance = [&](id_type id)
+			{
+				// to speed things up, ignore words that dont start with the same letter
+				if (options_.first_letter_opt && query_internal[0] != data_[id].name[0])
+				{
+					return;
+				}
+				// candidates further away than this can't make it into the results
+				const int bound = results.threshold();
+				verified++;
+				const int distance = matcher.distance(
+					fuzzy::string_view(data_[id].name.c_str(), std::min(data_[id].name.length(), truncate)), bound);
+				if (distance > bound)
+				{
+					return;
+				}
+				results.add(&data_[id], distance);
+				if (next)
+				{
+					next->matches.emplace_back(id, distance);
+				}
+			};
+			auto verify = [&](id_type id)
+			{
+				if (matches.count(id) < std::min<long>(UINT8_MAX, min_shared_ngrams(indexed_ngrams.size(), options_.ngram_size, results.threshold())))
+				{
+					return;
+				}
+				verify_distance(id);
+			};
+
+			if (previous)
+			{
+				// names at least as long as the query are cut to its length, so they got longer along with the query
+				// and their distance can only have grown: the ones that were out of reach last time still are.
+				// names sharing none of the old n-grams were never looked at, they are unless they were too far away.
+				// shorter names are searched as usual
+				std::erase_if(word_lengths, [&](uint16_t word_length) { return word_length >= truncate; });
+				for (const auto &[id, previous_distance] : previous->matches)
+				{
+					if (data_[id].name.length() < truncate)
+					{
+						continue;
+					}
+					matches.add(id);
+					reused++;
+					if (previous_distance <= results.threshold())
+					{
+						verify_distance(id);
+					}
+				}
+				// by the q-gram lemma, sharing none of the old n-grams means the old distance was at least this
+				const long unseen_bound = (long(previous->indexed_ngrams) + options_.ngram_size) / (options_.ngram_size + 1);
+				std::vector<id_type> unseen;
+				if (unseen_bound <= results.threshold())
+				{
+					for (ngram_token token : query_token_set)
+					{
+						const auto bucket = std::ranges::binary_search(previous->tokens, token) ? std::nullopt : inverted_index_.find(token);
+						if (!bucket)
+						{
+							continue;
+						}
+						for (const auto &group : bucket->groups())
+						{
+							if (group.word_length < truncate)
+							{
+								continue;
+							}
+							postings += group.count;
+							bucket->for_each(group, [&](id_type id)
+								{
+									if (matches.count(id) == 0)
+										unseen.push_back(id);
+									matches.add(id);
+								});
+						}
+					}
+				}
+				// they share n-grams with the query only through the new ones, so the counts are complete
+				for (id_type id : unseen)
+				{
+					verify(id);
+				}
+				clock.end_stage(search_stats.verify_time);
+			}
+
+			for (size_t i = 0; i < word_lengths.size() && length_bound(word_lengths[i]) <= results.threshold();)
+			{
+				// count all lengths with the same bound at once, then verify the new candidates
+				const size_t first_candidate = matches.touched().size();
+				for (const long bound = length_bound(word_lengths[i]); i < word_lengths.size() && length_bound(word_lengths[i]) == bound; i++)
+				{
+					postings += potential_matches(element_buckets, word_lengths[i], matches);
+				}
+				const auto candidates = std::span(matches.touched()).subspan(first_candidate);
+				clock.end_stage(search_stats.count_time);
+
+				// verifying the candidates with the most hits first quickly tightens the bound for the rest
+				uint8_t max_count = 0;
+				for (id_type id : candidates)
+				{
+					max_count = std::max(max_count, matches.count(id));
+				}
+				for (id_type id : candidates)
+				{
+					if (matches.count(id) == max_count)
+						verify(id);
+				}
+				for (id_type id : candidates)
+				{
+					if (matches.count(id) != max_count)
+						verify(id);
+				}
+				clock.end_stage(search_stats.verify_time);
+			}
+			search_stats.tokens = query_token_set.size();
+			search_stats.buckets = element_buckets.size();
+			search_stats.postings = postings;
+			search_stats.candidates = matches.touched().size();
+			search_stats.verified = verified;
+			search_stats.reused = reused;
+
+			if (next)
+			{
+				next->query = query;
+				next->threshold = results.threshold();
+				next->tokens.assign(query_token_set.begin(), query_token_set.end());
+				next->indexed_ngrams = indexed_ngrams.size();
+				std::erase_if(next->matches, [&](const auto &match) { return match.second > next->threshold; });
+				if (next->threshold >= UINT8_MAX || next->matches.size() > max_typeahead_matches)
+				{
+					*next = typeahead_state();
+				}
+			}
+			return results;
+		}
+
+	public:
+		// searches for the entries closest to the query. if truncate is set, names are cut to that length before comparing.
+		// results are collected into the given collection, and candidates that can't make it in aren't verified.
+		// if stats is set, it is filled with what the search did. stage timings add up, so pass fresh stats
+		virtual result_collection<T> fuzzy_search(const std::string& query, size_t truncate = 0, result_collection<T> results = result_collection<T>(), query_stats *stats = nullptr) const
+		{
+			return search(query, truncate, std::move(results), stats, nullptr, nullptr);
 		}
 
-		result_collection<T> completion_search(const std::string& query, size_t page_number = 0, size_t page_size = 0)
+		// fuzzy_search(query, query.length(), results), for a query typed one keystroke at a time.
+		// session holds what the last search of the session left behind, and is replaced with what this one leaves behind.
+		// if the query extends the last one by single byte characters, the search builds on what the last one found:
+		// a name that is cut to the query length has a distance at least as large as last time, so only the names
+		// that were within reach last time, the ones that were never looked at, and the shorter ones have to be checked.
+		// that holds as long as the threshold of the results didn't grow, otherwise the search starts over
+		result_collection<T> typeahead_search(const std::string& query, const result_collection<T> &results, typeahead_state &session, query_stats *stats = nullptr) const
 		{
-			if (!database<T>::ready_)
+			typeahead_state next;
+			if (session.threshold >= 0 && !session.query.empty() && query.size() > session.query.size() && query.starts_with(session.query))
 			{
-				build();
+				// names are cut to the query length in bytes, so every added byte has to be a character of its own.
+				// and the old candidates only cover the new ones if no n-gram went away, which happens when a
+				// short query outgrows the shorter n-grams
+				const fuzzy::string previous_internal = to_ngram_string(session.query);
+				const fuzzy::string query_internal = to_ngram_string(query);
+				const std::vector<ngram_token> query_tokens = ngram_tokens(query_internal, options_.ngram_size);
+				const std::set<ngram_token> query_token_set(query_tokens.begin(), query_tokens.end());
+				if (query_internal.starts_with(previous_internal) && query_internal.size() - previous_internal.size() == query.size() - session.query.size()
+					&& std::ranges::includes(query_token_set, session.tokens))
+				{
+					auto continued_results = search(query, query.length(), results, stats, &session, &next);
+					if (continued_results.threshold() <= session.threshold)
+					{
+						session = std::move(next);
+						return continued_results;
+					}
+					next = typeahead_state();
+				}
+			}
+			auto new_results = search(query, query.length(), results, stats, nullptr, &next);
+			session = std::move(next);
+			return new_results;
+		}
+	};
+
+	template <typename T>
+	class sorted_database : public database<T>
+	{
+	protected:
+
+		const struct {
+			size_t result_limit;
+		} options_;
+
+		// a node of the trie over the sorted names. it stands for the prefix its names share,
+		// chains of nodes with a single child are merged into one
+		struct trie_node
+		{
+			// the names below the node are data_[first, last). the ones that end at the node come first
+			id_type first;
+			id_type last;
+			// the children are nodes [children, children + child_count), ordered like the names
+			id_type children;
+			id_type child_count;
+			// length of the prefix
+			uint32_t depth;
+		};
+		// the root comes first
+		std::vector<trie_node> trie_;
+
+		// entries are ranked by the score member of T, if it has one
+		static constexpr bool scored = requires(const T &meta) { float(meta.score); };
+		// a segment tree over data_ that holds the best scored position below every node, leaves come last.
+		// empty if all entries score the same, then the ranking is the order of data_
+		std::vector<id_type> score_tree_;
+
+		float score(id_type id) const
+		{
+			if constexpr (scored)
+				return database<T>::data_[id].meta.score;
+			else
+				return 0;
+		}
+
+		// the better scored of two positions, ties go to the first one in data_
+		id_type better_scored(id_type a, id_type b) const
+		{
+			return score(a) > score(b) || (score(a) == score(b) && a < b) ? a : b;
+		}
+
+		void build_score_tree()
+		{
+			const auto &data = database<T>::data_;
+			score_tree_.clear();
+			if (std::ranges::all_of(data, [&](const db_entry<T> &entry) { return score(&entry - data.data()) == score(0); }))
+			{
+				return;
+			}
+			const size_t size = data.size();
+			score_tree_.resize(2 * size);
+			for (size_t i = 0; i < size; i++)
+			{
+				score_tree_[size + i] = i;
 			}
+			for (size_t i = size - 1; i > 0; i--)
+			{
+				score_tree_[i] = better_scored(score_tree_[2 * i], score_tree_[2 * i + 1]);
+			}
+		}
+
+		// the best scored position in [first, last), which must not be empty
+		id_type best_scored(id_type first, id_type last) const
+		{
+			const size_t size = database<T>::data_.size();
+			id_type best = first;
+			for (size_t left = first + size, right = last + size; left < right; left /= 2, right /= 2)
+			{
+				if (left & 1)
+					best = better_scored(best, score_tree_[left++]);
+				if (right & 1)
+					best = better_scored(best, score_tree_[--right]);
+			}
+			return best;
+		}
+
+		void build_trie()
+		{
+			const auto &data = database<T>::data_;
+			const auto common_prefix = [&](id_type first, id_type last)
+			{
+				// the names are sorted, so the first and the last one share the least
+				const fuzzy::string &a = data[first].name;
+				const fuzzy::string &b = data[last - 1].name;
+				return uint32_t(std::mismatch(a.begin(), a.begin() + std::min(a.size(), b.size()), b.begin()).first - a.begin());
+			};
+
+			trie_.clear();
+			// names without a valid character sort first, the n-gram index can't find them either
+			const id_type first = std::partition_point(data.begin(), data.end(), [](const db_entry<T> &entry) { return entry.name.empty(); }) - data.begin();
+			if (first == data.size())
+			{
+				return;
+			}
+			trie_.push_back(trie_node{first, id_type(data.size()), 0, 0, common_prefix(first, data.size())});
+			// nodes are added breadth first, so the children of a node end up next to each other
+			for (size_t i = 0; i < trie_.size(); i++)
+			{
+				const uint32_t depth = trie_[i].depth;
+				auto child = std::partition_point(data.begin() + trie_[i].first, data.begin() + trie_[i].last,
+					[&](const db_entry<T> &entry) { return entry.name.size() == depth; });
+				const auto last = data.begin() + trie_[i].last;
+				trie_[i].children = trie_.size();
+				while (child != last)
+				{
+					const ngram_char c = child->name[depth];
+					const auto child_end = std::partition_point(child, last, [&](const db_entry<T> &entry) { return entry.name[depth] == c; });
+					const id_type child_first = child - data.begin();
+					const id_type child_last = child_end - data.begin();
+					trie_.push_back(trie_node{child_first, child_last, 0, 0, common_prefix(child_first, child_last)});
+					child = child_end;
+				}
+				trie_[i].child_count = trie_.size() - trie_[i].children;
+			}
+			trie_.shrink_to_fit();
+		}
+
+
+		void add(std::string_view name, T&& meta, id_type id) override
+		{
+			assert(!database<T>::ready_ || !"Inserting into a sorted database rebuilds everything, so dont do it.");
+			if (name.empty())
+			{
+				return;
+			}
+			const fuzzy::string internal_name = internal::to_ngram_string(name);
+			database<T>::ready_ = false;
+			database<T>::data_.resize(id + 1);
+			database<T>::data_[id].name = std::move(internal_name);
+			database<T>::data_[id].meta = meta;
+		}
+
+		// the entries whose names, cut to the query length, equal the query
+		auto completion_range(const std::string &query) const
+		{
 			const fuzzy::string query_internal = internal::to_ngram_string(query);
-			auto range = std::ranges::equal_range(
+			return std::ranges::equal_range(
 				database<T>::data_, db_entry<T>{query_internal, T{}},
 				[truncation_length = query.size()](const db_entry<T> &a, const db_entry<T> &b)
 				{
@@ -575,9 +2072,270 @@ namespace fuzzy
 						fuzzy::string_view(a.name.data(), std::min(a.name.size(), truncation_length)),
 						fuzzy::string_view(b.name.data(), std::min(b.name.size(), truncation_length)));
 				});
+		}
+
+		result_collection<T> extract_page(std::pair<typename std::vector<db_entry<T>>::const_iterator, typename std::vector<db_entry<T>>::const_iterator> range, size_t page_number, size_t page_size) const
+		{
+			if (page_size == 0)
+			{
+				page_size = SIZE_MAX;
+				page_number = 0;
+			}
+			page_size = std::min<size_t>(page_size, options_.result_limit);
+
+			result_collection<T> results;
+			size_t start_index = page_number * page_size;
+			size_t end_index = start_index + page_size;
+			if (size_t(range.second - range.first) < start_index)
+			{
+				return results;
+			}
+			auto start_iter = range.first + start_index;
+			auto end_iter = (size_t(range.second - range.first) < end_index) ? range.second : range.first + end_index;
+			for (auto iter = start_iter; iter != end_iter; ++iter)
+			{
+				results.add(&(*iter), 0);
+			}
+			return results;
+		}
+
+	public:
+		using database<T>::add;
+
+		sorted_database(int ngram_size = 2, size_t result_limit = 100, bool first_letter_opt = true, uint64_t max_bucket_size = UINT64_MAX, bool compressed_postings = false)
+			: database<T>(ngram_size, first_letter_opt, max_bucket_size, compressed_postings), options_(result_limit)
+		{}
+
+		void build() override
+		{
+			database<T>::build_timings_.clear();
+			phase_timer timer(database<T>::build_timings_);
+
+			// sort data
+			parallel_sort(
+				database<T>::data_.begin(), database<T>::data_.end(),
+				[](const db_entry<T> &a, const db_entry<T> &b)
+				{ return string_compare(a.name, b.name); },
+				build_threads());
+			timer.end_phase("sort entries");
+
+			database<T>::build_index();
+
+			phase_timer trie_timer(database<T>::build_timings_);
+			build_trie();
+			trie_timer.end_phase("build trie");
+			build_score_tree();
+			trie_timer.end_phase("build score tree");
+
+			database<T>::ready_ = true;
+		}
+
+		bool load(snapshot_reader &reader) override
+		{
+			if (!database<T>::load(reader))
+			{
+				return false;
+			}
+			build_trie();
+			build_score_tree();
+			return true;
+		}
+
+		// heap memory of the completion trie, in bytes
+		size_t trie_memory_usage() const
+		{
+			return trie_.capacity() * sizeof(trie_node);
+		}
+
+		// fuzzy_search(query, query.length(), results), without the n-gram index: walks the trie of the names with the
+		// osa distance to the query, cut to the query length, and leaves every branch that gets too far away.
+		// it looks for the names at distance 0 first, then at distance 1 and so on, until the results are settled,
+		// so it doesn't rely on shared n-grams and finds everything within reach, even for the shortest queries
+		result_collection<T> completion_fuzzy_search(const std::string &query, result_collection<T> results = result_collection<T>(), query_stats *stats = nullptr) const
+		{
+			assert(database<T>::ready_ || !"Build the database before searching it.");
+			if (query.empty() || trie_.empty())
+			{
+				return results;
+			}
+			query_stats unused_stats;
+			query_stats &search_stats = stats ? *stats : unused_stats;
+			internal::stage_clock clock(search_stats.timed);
+
+			const auto &data = database<T>::data_;
+			const fuzzy::string query_internal = internal::to_ngram_string(query);
+			const size_t rows = query_internal.size() + 1;
+			const size_t truncate = query.size();
+			// column j holds the distances of the query prefixes to the first j characters of the name.
+			// a name of any length is at most max_distance away, so no column beyond rows + max_distance is needed
+			const int max_distance = int(std::max(query_internal.size(), truncate));
+			std::vector<int> columns(std::min(truncate, rows + max_distance) * rows + rows);
+			for (size_t i = 0; i < rows; i++)
+			{
+				columns[i] = i;
+			}
+
+			size_t nodes = 0;
+			size_t candidates = 0;
+			auto add_names = [&](id_type first, id_type last, int distance)
+			{
+				if (distance > results.threshold())
+				{
+					return;
+				}
+				candidates += last - first;
+				for (id_type id = first; id < last; id++)
+				{
+					results.add(&data[id], distance);
+				}
+			};
+
+			// adds the names below the node that are exactly distance away, the columns up to from_depth are filled in
+			auto visit = [&](auto &visit, const trie_node &node, uint32_t from_depth, int distance) -> void
+			{
+				nodes++;
+				const fuzzy::string &name = data[node.first].name;
+				if (from_depth == 0 && node.depth > 0 && database<T>::options_.first_letter_opt && name[0] != query_internal[0])
+				{
+					return;
+				}
+				const uint32_t depth = std::min<size_t>(node.depth, truncate);
+				for (uint32_t j = from_depth + 1; j <= depth; j++)
+				{
+					const int *before_previous = j > 1 ? &columns[(j - 2) * rows] : nullptr;
+					const int *previous = &columns[(j - 1) * rows];
+					int *column = &columns[j * rows];
+					column[0] = j;
+					int column_min = j;
+					for (size_t i = 1; i < rows; i++)
+					{
+						const int cost = query_internal[i - 1] == name[j - 1] ? 0 : 1;
+						int value = std::min({previous[i] + 1, column[i - 1] + 1, previous[i - 1] + cost});
+						if (i > 1 && j > 1 && query_internal[i - 1] == name[j - 2] && query_internal[i - 2] == name[j - 1])
+						{
+							value = std::min(value, before_previous[i - 2] + 1);
+						}
+						column[i] = value;
+						column_min = std::min(column_min, value);
+					}
+					// the minimum of a column never shrinks further down
+					if (column_min > distance)
+					{
+						return;
+					}
+				}
+				const int node_distance = columns[depth * rows + rows - 1];
+				if (depth == truncate)
+				{
+					// every name below is cut here
+					if (node_distance == distance)
+						add_names(node.first, node.last, distance);
+					return;
+				}
+				const id_type children_first = node.child_count ? trie_[node.children].first : node.last;
+				if (node_distance == distance)
+				{
+					add_names(node.first, children_first, distance);
+				}
+				for (id_type child = node.children; child < node.children + node.child_count; child++)
+				{
+					visit(visit, trie_[child], depth, distance);
+				}
+			};
+
+			for (int distance = 0; distance <= max_distance && distance <= results.threshold(); distance++)
+			{
+				visit(visit, trie_.front(), 0, distance);
+			}
+			clock.end_stage(search_stats.verify_time);
+			search_stats.nodes = nodes;
+			search_stats.candidates = candidates;
+			return results;
+		}
+
+		result_collection<T> exact_search(const std::string& query, size_t page_number = 0, size_t page_size = 0) const
+		{
+			assert(database<T>::ready_ || !"Build the database before searching it.");
+			const fuzzy::string query_internal = internal::to_ngram_string(query);
+			auto range = std::ranges::equal_range(
+				database<T>::data_, db_entry<T>{query_internal, T{}},
+				[](const db_entry<T> &a, const db_entry<T> &b)
+				{ return string_compare(a.name, b.name); });
 			return extract_page(range, page_number, page_size);
 		}
 
+		result_collection<T> completion_search(const std::string& query, size_t page_number = 0, size_t page_size = 0) const
+		{
+			assert(database<T>::ready_ || !"Build the database before searching it.");
+			return extract_page(completion_range(query), page_number, page_size);
+		}
+
+		// completion_search, but the completions are ordered by score, highest first. every position in the ranking
+		// costs a lookup in the score tree, so the page is found without looking at the rest of the completions
+		result_list<T> ranked_completion_search(const std::string& query, size_t page_number = 0, size_t page_size = 0) const
+		{
+			assert(database<T>::ready_ || !"Build the database before searching it.");
+			if (score_tree_.empty())
+			{
+				return completion_search(query, page_number, page_size).all();
+			}
+			if (page_size == 0)
+			{
+				page_size = SIZE_MAX;
+				page_number = 0;
+			}
+			page_size = std::min<size_t>(page_size, options_.result_limit);
+
+			const auto &data = database<T>::data_;
+			const auto range = completion_range(query);
+			const id_type first = range.begin() - data.begin();
+			const id_type last = range.end() - data.begin();
+			const size_t count = last - first;
+			const size_t start = page_number > count / page_size ? count : page_number * page_size;
+			const size_t end = start + std::min(page_size, count - start);
+			result_list<T> results;
+
+			// pages deep into the completions are cheaper to cut from the sorted range
+			if (end > count / 8)
+			{
+				std::vector<id_type> ids(count);
+				std::iota(ids.begin(), ids.end(), first);
+				std::partial_sort(ids.begin(), ids.begin() + end, ids.end(),
+					[this](id_type a, id_type b) { return a != b && better_scored(a, b) == a; });
+				for (size_t rank = start; rank < end; rank++)
+				{
+					results.emplace_back(&data[ids[rank]], 0);
+				}
+				return results;
+			}
+
+			// every range is ranked below its best scored entry, which splits it in two once it is taken
+			struct scored_range
+			{
+				id_type best, first, last;
+			};
+			const auto ranks_below = [this](const scored_range &a, const scored_range &b) { return better_scored(a.best, b.best) == b.best; };
+			std::priority_queue<scored_range, std::vector<scored_range>, decltype(ranks_below)> ranges(ranks_below);
+			const auto push = [&](id_type first, id_type last)
+			{
+				if (first < last)
+					ranges.push(scored_range{best_scored(first, last), first, last});
+			};
+			push(first, last);
+			for (size_t rank = 0; rank < end; rank++)
+			{
+				const scored_range range = ranges.top();
+				ranges.pop();
+				if (rank >= start)
+				{
+					results.emplace_back(&data[range.best], 0);
+				}
+				push(range.first, range.best);
+				push(range.best + 1, range.last);
+			}
+			return results;
+		}
+
 		using database<T>::fuzzy_search;
 	};
 
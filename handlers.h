@@ -1,55 +1,273 @@
 #pragma once
 
+#include <functional>
+#include <memory>
+#include <atomic>
+#include <optional>
+#include <sstream>
+#include <iomanip>
+
 #include "httplib.h"
+#include "json.hpp"
 
 #include "fuzzy.hpp"
 #include "util.h"
+#include "request_log.h"
+#include "metrics.h"
+#include "result_cache.h"
+#include "typeahead_sessions.h"
+#include "worker_pool.h"
+
+// handlers fetch the current state for every request and keep it alive until the response is written,
+// so a reload never pulls the database out from under a running request.
+// a state has a built sorted_database of entry_type called database, and returns the json line of an entry
+// with get_element(entry, buffer), which works like dataset::get_element. fuzzy completions of queries up to
+// trie_query_length characters are searched in the trie of the database.
+// states are never modified once they are handed out, apart from their result_cache called cache and their
+// typeahead_sessions called sessions, which start out empty for every state and so never mix in another database
+template <typename State>
+using state_source = std::function<std::shared_ptr<const State>()>;
+
+template <typename State>
+httplib::Server::Handler fuzzy_handler(state_source<State> source, request_log &log, endpoint_metrics &metrics);
+template <typename State>
+httplib::Server::Handler fuzzy_list_handler(state_source<State> source, request_log &log, endpoint_metrics &metrics);
+template <typename State>
+httplib::Server::Handler exact_handler(state_source<State> source, request_log &log, endpoint_metrics &metrics);
+template <typename State>
+httplib::Server::Handler exact_list_handler(state_source<State> source, request_log &log, endpoint_metrics &metrics);
+template <typename State>
+httplib::Server::Handler completion_handler(state_source<State> source, request_log &log, endpoint_metrics &metrics);
+template <typename State>
+httplib::Server::Handler completion_list_handler(state_source<State> source, request_log &log, endpoint_metrics &metrics);
+httplib::Server::Handler batch_handler(httplib::Server::Handler handler);
+
+// the most queries a single batch request may contain
+constexpr size_t max_batch_size = 10000;
 
-template <typename T>
-httplib::Server::Handler fuzzy_handler(fuzzy::sorted_database<T> &database);
-template <typename T>
-httplib::Server::Handler fuzzy_list_handler(fuzzy::sorted_database<T> &database);
-template <typename T>
-httplib::Server::Handler exact_handler(fuzzy::sorted_database<T> &database);
-template <typename T>
-httplib::Server::Handler exact_list_handler(fuzzy::sorted_database<T> &database);
-template <typename T>
-httplib::Server::Handler completion_handler(fuzzy::sorted_database<T> &database);
-template <typename T>
-httplib::Server::Handler completion_list_handler(fuzzy::sorted_database<T> &database);
-
-
-template <typename T>
-std::string process_results(const std::vector<fuzzy::result<T>>& results, bool as_list = false)
+
+// follows a search through its stages and reports it once the response is ready: to the request log, to the metrics,
+// and as Server-Timing and X-Query-Trace headers if the request asked for a trace with debug=1 or an X-Debug-Trace header.
+// the stages of a fuzzy search are only timed for traced requests, and when slow requests are logged
+class search_trace
 {
-	std::stringstream strstream;
-	if (!as_list)
+	request_log &log_;
+	endpoint_metrics &metrics_;
+	const bool requested_;
+	const std::chrono::steady_clock::time_point start_ = std::chrono::steady_clock::now();
+	std::chrono::steady_clock::time_point stage_start_ = start_;
+	// microseconds per stage
+	uint64_t search_time_ = 0;
+	uint64_t extract_time_ = 0;
+	uint64_t serialize_time_ = 0;
+	std::optional<fuzzy::query_stats> stats_;
+	bool cached_ = false;
+
+	uint64_t end_stage()
+	{
+		const auto now = std::chrono::steady_clock::now();
+		const uint64_t time = std::chrono::duration_cast<std::chrono::microseconds>(now - stage_start_).count();
+		stage_start_ = now;
+		return time;
+	}
+
+public:
+	search_trace(const httplib::Request &req, request_log &log, endpoint_metrics &metrics)
+		: log_(log), metrics_(metrics), requested_(req.get_param_value("debug") == "1" || req.has_header("X-Debug-Trace"))
+	{
+	}
+
+	// stats for the fuzzy search of the request, if it makes one
+	fuzzy::query_stats *fuzzy_stats()
+	{
+		stats_.emplace();
+		stats_->timed = requested_ || log_.slow_query_time();
+		return &*stats_;
+	}
+
+	void end_search()
+	{
+		search_time_ = end_stage();
+	}
+	// the results came from the cache, so the search stage only looked them up
+	void cache_hit()
+	{
+		cached_ = true;
+	}
+	void end_extract()
+	{
+		extract_time_ = end_stage();
+	}
+	void end_serialize()
+	{
+		serialize_time_ = end_stage();
+	}
+
+	void finish(httplib::Response &res, const std::string &query, size_t result_count, int distance)
+	{
+		const uint64_t total_time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_).count();
+		request_record record;
+		record.endpoint = metrics_.name.c_str();
+		record.microseconds = total_time;
+		record.set_query(query);
+		record.distance = result_count ? distance : -1;
+		record.results = result_count;
+		record.slow = log_.slow_query_time() && total_time >= log_.slow_query_time();
+		record.search_time = search_time_;
+		record.extract_time = extract_time_;
+		record.serialize_time = serialize_time_;
+		if (stats_)
+		{
+			record.candidates = stats_->candidates;
+			record.verified = stats_->verified;
+			record.postings = stats_->postings;
+			record.lookup_time = stats_->lookup_time / 1000;
+			record.count_time = stats_->count_time / 1000;
+			record.verify_time = stats_->verify_time / 1000;
+			metrics_.candidates.observe(stats_->candidates);
+			metrics_.verifications.observe(stats_->verified);
+		}
+		log_.log(record);
+
+		if (!requested_)
+		{
+			return;
+		}
+		std::stringstream timing;
+		timing << std::fixed << std::setprecision(3);
+		timing << "search;dur=" << search_time_ / 1000.0;
+		if (stats_)
+		{
+			timing << ", lookup;dur=" << stats_->lookup_time / 1e6;
+			timing << ", count;dur=" << stats_->count_time / 1e6;
+			timing << ", verify;dur=" << stats_->verify_time / 1e6;
+		}
+		timing << ", extract;dur=" << extract_time_ / 1000.0;
+		timing << ", serialize;dur=" << serialize_time_ / 1000.0;
+		timing << ", total;dur=" << total_time / 1000.0;
+		if (cached_)
+		{
+			timing << ", cache;desc=hit";
+		}
+		res.set_header("Server-Timing", timing.str());
+
+		nlohmann::json counters = {{"results", result_count}, {"cached", cached_}};
+		if (stats_)
+		{
+			counters["tokens"] = stats_->tokens;
+			counters["buckets"] = stats_->buckets;
+			counters["postings"] = stats_->postings;
+			counters["candidates"] = stats_->candidates;
+			counters["verified"] = stats_->verified;
+			counters["reused"] = stats_->reused;
+			counters["nodes"] = stats_->nodes;
+		}
+		res.set_header("X-Query-Trace", counters.dump());
+		res.set_header("Timing-Allow-Origin", "*");
+		res.set_header("Access-Control-Expose-Headers", "Server-Timing, X-Query-Trace");
+	}
+};
+
+// serves the results of a search from the state's cache, see result_cache::key for the parameters. if they aren't cached,
+// search runs, ending the search stage of the trace and returning the results to serve, and they are cached
+template <typename State, typename Search>
+typename result_cache<typename State::entry_type>::results cached_search(const State &state, search_trace &trace,
+	const std::string &endpoint, const std::string &query, std::initializer_list<long> parameters, Search &&search)
+{
+	using T = typename State::entry_type;
+	if (!state.cache.enabled())
+	{
+		return std::make_shared<const fuzzy::result_list<T>>(search());
+	}
+	const std::string key = result_cache<T>::key(endpoint, query, parameters);
+	if (auto results = state.cache.find(key))
+	{
+		trace.end_search();
+		trace.cache_hit();
+		return results;
+	}
+	auto results = std::make_shared<const fuzzy::result_list<T>>(search());
+	state.cache.insert(key, results);
+	return results;
+}
+
+// the fuzzy search of a fuzzycomplete request, names are cut to the query length. short queries share few n-grams
+// with anything, so they walk the trie. otherwise, if the request names a typeahead session with a session parameter,
+// the search builds on the last one of the session, see typeahead_sessions::key for the parameter
+template <typename State>
+fuzzy::result_collection<typename State::entry_type> fuzzycomplete_search(const State &state, const httplib::Request &req, search_trace &trace,
+	const std::string &endpoint, const std::string &query, const fuzzy::result_collection<typename State::entry_type> &results, long parameter)
+{
+	if (fuzzy::internal::to_ngram_string(query).size() <= state.trie_query_length)
+	{
+		return state.database.completion_fuzzy_search(query, results, trace.fuzzy_stats());
+	}
+	if (!req.has_param("session") || !state.sessions.enabled())
 	{
-		assert(!results.empty());
-		strstream << results[0].element->meta;
-		return strstream.str();
+		return state.database.fuzzy_search(query, query.length(), results, trace.fuzzy_stats());
 	}
+	const std::string key = typeahead_sessions::key(req.get_param_value("session"), endpoint, parameter);
+	fuzzy::typeahead_state session = state.sessions.take(key);
+	auto query_result = state.database.typeahead_search(query, results, session, trace.fuzzy_stats());
+	state.sessions.put(key, std::move(session));
+	return query_result;
+}
 
+// the response body for the results: a single element, or a list of them. the size is known up front,
+// so every line is copied exactly once, straight from where the dataset keeps it
+template <typename State, typename T>
+std::string process_results(const State &state, const std::vector<fuzzy::result<T>>& results, bool as_list = false)
+{
+	assert(as_list || !results.empty());
+	const size_t count = as_list ? results.size() : 1;
+	// only filled for lines that have to be read from disk
+	std::vector<std::string> buffers(count);
+	std::vector<std::string_view> elements(count);
+	size_t size = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		elements[i] = state.get_element(results[i].element->meta, buffers[i]);
+		size += elements[i].size();
+	}
+	if (!as_list)
+	{
+		return std::string(elements[0]);
+	}
 	if (results.empty())
 	{
 		return "[]";
 	}
 
-	strstream << "[\n";
-	for (size_t i = 0; i + 1 < results.size(); i++)
+	std::string body;
+	// "[\n", a tab and ",\n" (or "\n") around every element, "]"
+	body.reserve(size + 3 * count + 3);
+	body += "[\n";
+	for (size_t i = 0; i < count; i++)
 	{
-		strstream << "\t" << results[i].element->meta << ",\n";
+		body += '\t';
+		body += elements[i];
+		body += i + 1 < count ? ",\n" : "\n";
 	}
-	strstream << "\t" << results.back().element->meta << "\n]";
-	return strstream.str();
+	body += ']';
+	return body;
+}
+
+// sets the body like set_content, without copying it
+inline void set_moved_content(httplib::Response &res, std::string &&body, const char *content_type)
+{
+	res.body = std::move(body);
+	const auto content_type_headers = res.headers.equal_range("Content-Type");
+	res.headers.erase(content_type_headers.first, content_type_headers.second);
+	res.set_header("Content-Type", content_type);
 }
 
 
-template <typename T>
-httplib::Server::Handler fuzzy_handler(fuzzy::sorted_database<T> &database)
+template <typename State>
+httplib::Server::Handler fuzzy_handler(state_source<State> source, request_log &log, endpoint_metrics &metrics)
 {
-	return [&](const httplib::Request &req, httplib::Response &res)
+	return [source, &log, &metrics](const httplib::Request &req, httplib::Response &res)
 	{
+		using T = typename State::entry_type;
 		if (!req.has_param("q"))
 		{
 			res.status = 400;
@@ -57,28 +275,39 @@ httplib::Server::Handler fuzzy_handler(fuzzy::sorted_database<T> &database)
 			return;
 		}
 		const auto query_string = req.get_param_value("q");
-		timer query_timer;
-		auto query_result = database.exact_search(query_string, 0, 1);
-		if (query_result.empty())
+		const auto state = source();
+		auto &database = state->database;
+		search_trace trace(req, log, metrics);
+		const auto result_list = cached_search(*state, trace, metrics.name, query_string, {}, [&]
 		{
-			query_result = database.fuzzy_search(query_string);
-		}
-		std::cout << "fuzzy-searched " << query_string << " in " << query_timer.get() << "ms" << std::endl;
-		if (query_result.empty())
+			auto query_result = database.exact_search(query_string, 0, 1);
+			if (query_result.empty())
+			{
+				query_result = database.fuzzy_search(query_string, 0, fuzzy::result_collection<T>(1, 0), trace.fuzzy_stats());
+			}
+			trace.end_search();
+			return query_result.best();
+		});
+		trace.end_extract();
+		if (result_list->empty())
 		{
+			trace.finish(res, query_string, 0, -1);
 			res.status = 404;
 			res.set_content("no matches", "text/plain");
 			return;
 		}
-		res.set_content(process_results(query_result.best(), false), "application/json");
+		set_moved_content(res, process_results(*state, *result_list, false), "application/json");
+		trace.end_serialize();
+		trace.finish(res, query_string, result_list->size(), result_list->front().distance);
 	};
 }
 
-template <typename T>
-httplib::Server::Handler fuzzy_list_handler(fuzzy::sorted_database<T> &database)
+template <typename State>
+httplib::Server::Handler fuzzy_list_handler(state_source<State> source, request_log &log, endpoint_metrics &metrics)
 {
-	return [&](const httplib::Request &req, httplib::Response &res)
+	return [source, &log, &metrics](const httplib::Request &req, httplib::Response &res)
 	{
+		using T = typename State::entry_type;
 		if (!req.has_param("q"))
 		{
 			res.status = 400;
@@ -86,22 +315,34 @@ httplib::Server::Handler fuzzy_list_handler(fuzzy::sorted_database<T> &database)
 			return;
 		}
 		const auto query_string = req.get_param_value("q");
-		timer query_timer;
-		auto query_result = database.exact_search(query_string);
-		if (query_result.empty())
+		const auto state = source();
+		auto &database = state->database;
+		const int count = req.has_param("count") ? std::stoi(req.get_param_value("count")) : 10;
+		const size_t max_count = count > 0 ? count : SIZE_MAX;
+		search_trace trace(req, log, metrics);
+		const auto result_list = cached_search(*state, trace, metrics.name, query_string, {count}, [&]
 		{
-			query_result = database.fuzzy_search(query_string);
-		}
-		std::cout << "fuzzy-searched " << query_string << " in " << query_timer.get() << "ms" << std::endl;
-		res.set_content(process_results(query_result.best(), true), "application/json");
+			auto query_result = database.exact_search(query_string, 0, std::max(0, count));
+			if (query_result.empty())
+			{
+				query_result = database.fuzzy_search(query_string, 0, fuzzy::result_collection<T>(max_count, 0), trace.fuzzy_stats());
+			}
+			trace.end_search();
+			return query_result.best();
+		});
+		trace.end_extract();
+		set_moved_content(res, process_results(*state, *result_list, true), "application/json");
+		trace.end_serialize();
+		trace.finish(res, query_string, result_list->size(), result_list->empty() ? -1 : result_list->front().distance);
 	};
 }
 
-template <typename T>
-httplib::Server::Handler fuzzycomplete_handler(fuzzy::sorted_database<T> &database)
+template <typename State>
+httplib::Server::Handler fuzzycomplete_handler(state_source<State> source, request_log &log, endpoint_metrics &metrics)
 {
-	return [&](const httplib::Request &req, httplib::Response &res)
+	return [source, &log, &metrics](const httplib::Request &req, httplib::Response &res)
 	{
+		using T = typename State::entry_type;
 		if (!req.has_param("q"))
 		{
 			res.status = 400;
@@ -109,24 +350,34 @@ httplib::Server::Handler fuzzycomplete_handler(fuzzy::sorted_database<T> &databa
 			return;
 		}
 		const auto query_string = req.get_param_value("q");
-		timer query_timer;
-		const auto result_list = database.fuzzy_search(query_string, query_string.length()).extract(0, 1, true);
-		std::cout << "fuzzycomplete-searched " << query_string << " in " << query_timer.get() << "ms" << std::endl;
-		if (result_list.empty())
+		const auto state = source();
+		search_trace trace(req, log, metrics);
+		const auto result_list = cached_search(*state, trace, metrics.name, query_string, {}, [&]
 		{
+			const auto query_result = fuzzycomplete_search(*state, req, trace, metrics.name, query_string, fuzzy::result_collection<T>(1, 0, true), 0);
+			trace.end_search();
+			return query_result.extract(0, 1, true);
+		});
+		trace.end_extract();
+		if (result_list->empty())
+		{
+			trace.finish(res, query_string, 0, -1);
 			res.status = 404;
 			res.set_content("no matches", "text/plain");
 			return;
 		}
-		res.set_content(process_results(result_list, false), "application/json");
+		set_moved_content(res, process_results(*state, *result_list, false), "application/json");
+		trace.end_serialize();
+		trace.finish(res, query_string, result_list->size(), result_list->front().distance);
 	};
 }
 
-template <typename T>
-httplib::Server::Handler fuzzycomplete_list_handler(fuzzy::sorted_database<T> &database)
+template <typename State>
+httplib::Server::Handler fuzzycomplete_list_handler(state_source<State> source, request_log &log, endpoint_metrics &metrics)
 {
-	return [&](const httplib::Request &req, httplib::Response &res)
+	return [source, &log, &metrics](const httplib::Request &req, httplib::Response &res)
 	{
+		using T = typename State::entry_type;
 		if (!req.has_param("q"))
 		{
 			res.status = 400;
@@ -134,19 +385,27 @@ httplib::Server::Handler fuzzycomplete_list_handler(fuzzy::sorted_database<T> &d
 			return;
 		}
 		const auto query_string = req.get_param_value("q");
+		const auto state = source();
 		const int similarity_tolerance = req.has_param("tol") ? std::stoi(req.get_param_value("tol")) : 2;
-		timer query_timer;
-		// todo: dont hardcode max_count
-		const auto result_list = database.fuzzy_search(query_string, query_string.length()).extract(0, 50, true, similarity_tolerance);
-		std::cout << "fuzzycomplete-searched " << query_string << " in " << query_timer.get() << "ms" << std::endl;
-		res.set_content(process_results(result_list, true), "application/json");
+		search_trace trace(req, log, metrics);
+		const auto result_list = cached_search(*state, trace, metrics.name, query_string, {similarity_tolerance}, [&]
+		{
+			// todo: dont hardcode max_count
+			const auto query_result = fuzzycomplete_search(*state, req, trace, metrics.name, query_string, fuzzy::result_collection<T>(50, similarity_tolerance, true), similarity_tolerance);
+			trace.end_search();
+			return query_result.extract(0, 50, true, similarity_tolerance);
+		});
+		trace.end_extract();
+		set_moved_content(res, process_results(*state, *result_list, true), "application/json");
+		trace.end_serialize();
+		trace.finish(res, query_string, result_list->size(), result_list->empty() ? -1 : result_list->front().distance);
 	};
 }
 
-template <typename T>
-httplib::Server::Handler exact_handler(fuzzy::sorted_database<T> &database)
+template <typename State>
+httplib::Server::Handler exact_handler(state_source<State> source, request_log &log, endpoint_metrics &metrics)
 {
-	return [&](const httplib::Request &req, httplib::Response &res)
+	return [source, &log, &metrics](const httplib::Request &req, httplib::Response &res)
 	{
 		if (!req.has_param("q"))
 		{
@@ -155,23 +414,30 @@ httplib::Server::Handler exact_handler(fuzzy::sorted_database<T> &database)
 			return;
 		}
 		const auto query_string = req.get_param_value("q");
-		timer query_timer;
+		const auto state = source();
+		auto &database = state->database;
+		search_trace trace(req, log, metrics);
 		auto query_result = database.exact_search(query_string, 0, 1);
-		std::cout << "exact-searched " << query_string << " in " << query_timer.get() << "ms" << std::endl;
+		trace.end_search();
 		if (query_result.empty())
 		{
+			trace.finish(res, query_string, 0, -1);
 			res.status = 404;
 			res.set_content("no matches", "text/plain");
 			return;
 		}
-		res.set_content(process_results(query_result.all(), false), "application/json");
+		const auto result_list = query_result.all();
+		trace.end_extract();
+		set_moved_content(res, process_results(*state, result_list, false), "application/json");
+		trace.end_serialize();
+		trace.finish(res, query_string, result_list.size(), 0);
 	};
 }
 
-template <typename T>
-httplib::Server::Handler exact_list_handler(fuzzy::sorted_database<T> &database)
+template <typename State>
+httplib::Server::Handler exact_list_handler(state_source<State> source, request_log &log, endpoint_metrics &metrics)
 {
-	return [&](const httplib::Request &req, httplib::Response &res)
+	return [source, &log, &metrics](const httplib::Request &req, httplib::Response &res)
 	{
 		if (!req.has_param("q"))
 		{
@@ -180,19 +446,25 @@ httplib::Server::Handler exact_list_handler(fuzzy::sorted_database<T> &database)
 			return;
 		}
 		const auto query_string = req.get_param_value("q");
+		const auto state = source();
+		auto &database = state->database;
 		const int page_number = req.has_param("page") ? std::stoi(req.get_param_value("page")) : 0;
 		const int page_size = req.has_param("count") ? std::stoi(req.get_param_value("count")) : 10;
-		timer query_timer;
+		search_trace trace(req, log, metrics);
 		auto query_result = database.exact_search(query_string, std::max(0, page_number), std::max(0, page_size));
-		std::cout << "exact-searched " << query_string << " in " << query_timer.get() << "ms" << std::endl;
-		res.set_content(process_results(query_result.all(), true), "application/json");
+		trace.end_search();
+		const auto result_list = query_result.all();
+		trace.end_extract();
+		set_moved_content(res, process_results(*state, result_list, true), "application/json");
+		trace.end_serialize();
+		trace.finish(res, query_string, result_list.size(), 0);
 	};
 }
 
-template <typename T>
-httplib::Server::Handler completion_handler(fuzzy::sorted_database<T> &database)
+template <typename State>
+httplib::Server::Handler completion_handler(state_source<State> source, request_log &log, endpoint_metrics &metrics)
 {
-	return [&](const httplib::Request &req, httplib::Response &res)
+	return [source, &log, &metrics](const httplib::Request &req, httplib::Response &res)
 	{
 		if (!req.has_param("q"))
 		{
@@ -201,25 +473,31 @@ httplib::Server::Handler completion_handler(fuzzy::sorted_database<T> &database)
 			return;
 		}
 		const auto query_string = req.get_param_value("q");
+		const auto state = source();
+		auto &database = state->database;
 		const int page_number = req.has_param("page") ? std::stoi(req.get_param_value("page")) : 0;
 		const int page_size = req.has_param("count") ? std::stoi(req.get_param_value("count")) : 10;
-		timer query_timer;
-		auto query_result = database.completion_search(query_string, std::max(0, page_number), std::max(0, page_size));
-		std::cout << "completion-searched " << query_string << " in " << query_timer.get() << "ms" << std::endl;
-		if (query_result.empty())
+		search_trace trace(req, log, metrics);
+		const auto result_list = database.ranked_completion_search(query_string, std::max(0, page_number), std::max(0, page_size));
+		trace.end_search();
+		if (result_list.empty())
 		{
+			trace.finish(res, query_string, 0, -1);
 			res.status = 404;
 			res.set_content("no matches", "text/plain");
 			return;
 		}
-		res.set_content(process_results(query_result.all(), false), "application/json");
+		trace.end_extract();
+		set_moved_content(res, process_results(*state, result_list, false), "application/json");
+		trace.end_serialize();
+		trace.finish(res, query_string, result_list.size(), 0);
 	};
 }
 
-template <typename T>
-httplib::Server::Handler completion_list_handler(fuzzy::sorted_database<T> &database)
+template <typename State>
+httplib::Server::Handler completion_list_handler(state_source<State> source, request_log &log, endpoint_metrics &metrics)
 {
-	return [&](const httplib::Request &req, httplib::Response &res)
+	return [source, &log, &metrics](const httplib::Request &req, httplib::Response &res)
 	{
 		if (!req.has_param("q"))
 		{
@@ -228,11 +506,138 @@ httplib::Server::Handler completion_list_handler(fuzzy::sorted_database<T> &data
 			return;
 		}
 		const auto query_string = req.get_param_value("q");
+		const auto state = source();
+		auto &database = state->database;
 		const int page_number = req.has_param("page") ? std::stoi(req.get_param_value("page")) : 0;
 		const int page_size = req.has_param("count") ? std::stoi(req.get_param_value("count")) : 10;
-		timer query_timer;
-		auto query_result = database.completion_search(query_string, std::max(0, page_number), std::max(0, page_size));
-		std::cout << "completion-searched " << query_string << " in " << query_timer.get() << "ms" << std::endl;
-		res.set_content(process_results(query_result.all(), true), "application/json");
+		search_trace trace(req, log, metrics);
+		const auto result_list = database.ranked_completion_search(query_string, std::max(0, page_number), std::max(0, page_size));
+		trace.end_search();
+		trace.end_extract();
+		set_moved_content(res, process_results(*state, result_list, true), "application/json");
+		trace.end_serialize();
+		trace.finish(res, query_string, result_list.size(), 0);
+	};
+}
+
+// turns a batch query into the parameters of a single request:
+// a string is the search term, an object holds the parameters by name
+inline httplib::Params batch_query_params(const nlohmann::json &query)
+{
+	httplib::Params params;
+	if (query.is_string())
+	{
+		params.emplace("q", query.get<std::string>());
+		return params;
+	}
+	if (!query.is_object())
+	{
+		throw std::invalid_argument("queries must be strings or objects");
+	}
+	for (const auto &[name, value] : query.items())
+	{
+		params.emplace(name, value.is_string() ? value.get<std::string>() : value.dump());
+	}
+	return params;
+}
+
+// runs the queries in the body of a POST request through a GET handler, spread over the workers.
+// the body is either a JSON array of queries, answered with a JSON array,
+// or one query per line (NDJSON), answered with one line per query.
+// responses are in query order. failed queries are answered with {"status": ..., "error": ...}
+inline httplib::Server::Handler batch_handler(httplib::Server::Handler handler, worker_pool &workers)
+{
+	return [handler = std::move(handler), &workers](const httplib::Request &req, httplib::Response &res)
+	{
+		const size_t body_start = req.body.find_first_not_of(" \t\r\n");
+		const bool as_array = body_start != std::string::npos && req.body[body_start] == '[';
+		std::vector<httplib::Params> queries;
+		try
+		{
+			if (as_array)
+			{
+				for (const auto &query : nlohmann::json::parse(req.body))
+				{
+					queries.push_back(batch_query_params(query));
+				}
+			}
+			else
+			{
+				std::istringstream lines(req.body);
+				for (std::string line; std::getline(lines, line);)
+				{
+					if (line.find_first_not_of(" \t\r") != std::string::npos)
+					{
+						queries.push_back(batch_query_params(nlohmann::json::parse(line)));
+					}
+				}
+			}
+		}
+		catch (const std::exception &e)
+		{
+			res.status = 400;
+			res.set_content(std::string("invalid batch: ") + e.what(), "text/plain");
+			return;
+		}
+		if (queries.size() > max_batch_size)
+		{
+			res.status = 413;
+			res.set_content("too many queries, the limit is " + std::to_string(max_batch_size), "text/plain");
+			return;
+		}
+
+		std::vector<std::string> responses(queries.size());
+		workers.for_each(queries.size(), [&](size_t index)
+		{
+			httplib::Request query;
+			query.params = std::move(queries[index]);
+			httplib::Response response;
+			try
+			{
+				handler(query, response);
+			}
+			catch (const std::exception &e)
+			{
+				response.status = 500;
+				response.body = e.what();
+			}
+			if (response.status == -1 || response.status == 200)
+			{
+				responses[index] = std::move(response.body);
+			}
+			else
+			{
+				responses[index] = nlohmann::json({{"status", response.status}, {"error", response.body}}).dump();
+			}
+			if (!as_array)
+			{
+				// dataset lines hold no line breaks, so only the list formatting has to go
+				std::erase(responses[index], '\n');
+			}
+		});
+
+		size_t body_size = 3;
+		for (const std::string &response : responses)
+		{
+			body_size += response.size() + 2;
+		}
+		std::string body;
+		body.reserve(body_size);
+		body += as_array ? "[\n" : "";
+		for (size_t index = 0; index < responses.size(); index++)
+		{
+			if (as_array)
+			{
+				body += index ? ",\n" : "";
+				body += responses[index];
+			}
+			else
+			{
+				body += responses[index];
+				body += '\n';
+			}
+		}
+		body += as_array ? "\n]" : "";
+		set_moved_content(res, std::move(body), as_array ? "application/json" : "application/x-ndjson");
 	};
 }
@@ -0,0 +1,468 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <optional>
+#include <cstdint>
+#include <cstdlib>
+#include <cmath>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// reads a single top-level string field of a JSON object without building a DOM, and optionally a number field
+// along with it. the whole document is still validated, so a value is only returned where a full parser would return the same one
+class json_field_scanner
+{
+	// deeper documents are left to the full parser
+	static constexpr int max_depth = 64;
+
+	const char *pos_;
+	const char *const end_;
+	const std::string_view field_;
+	const std::string_view number_field_;
+	// the last value of the field, if it was a string
+	std::optional<std::string> value_;
+	// the last value of the number field, if it was a number
+	std::optional<double> number_;
+	std::string key_;
+
+	void skip_whitespace()
+	{
+		while (pos_ != end_ && (*pos_ == ' ' || *pos_ == '\t' || *pos_ == '\n' || *pos_ == '\r'))
+		{
+			++pos_;
+		}
+	}
+
+	bool consume(char c)
+	{
+		skip_whitespace();
+		if (pos_ != end_ && *pos_ == c)
+		{
+			++pos_;
+			return true;
+		}
+		return false;
+	}
+
+	// advances to the next string byte that needs a closer look:
+	// a quote, a backslash, a control character or a non-ascii byte
+	void skip_plain_bytes()
+	{
+#if defined(__SSE2__)
+		const __m128i quote = _mm_set1_epi8('"');
+		const __m128i backslash = _mm_set1_epi8('\\');
+		const __m128i space = _mm_set1_epi8(0x20);
+		while (end_ - pos_ >= 16)
+		{
+			const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pos_));
+			// compared as signed, non-ascii bytes are below 0x20 as well
+			const __m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, quote), _mm_cmpeq_epi8(block, backslash)),
+				_mm_cmplt_epi8(block, space));
+			const int mask = _mm_movemask_epi8(special);
+			if (mask)
+			{
+				pos_ += __builtin_ctz(mask);
+				return;
+			}
+			pos_ += 16;
+		}
+#endif
+		while (pos_ != end_ && *pos_ != '"' && *pos_ != '\\' && uint8_t(*pos_) >= 0x20 && uint8_t(*pos_) < 0x80)
+		{
+			++pos_;
+		}
+	}
+
+	// skips one utf-8 encoded code point, rejecting overlong forms, surrogates and values above U+10FFFF
+	bool skip_utf8()
+	{
+		const uint8_t lead = *pos_;
+		int length;
+		uint8_t second_min = 0x80, second_max = 0xBF;
+		if (lead >= 0xC2 && lead <= 0xDF)
+		{
+			length = 2;
+		}
+		else if (lead >= 0xE0 && lead <= 0xEF)
+		{
+			length = 3;
+			second_min = lead == 0xE0 ? 0xA0 : 0x80;
+			second_max = lead == 0xED ? 0x9F : 0xBF;
+		}
+		else if (lead >= 0xF0 && lead <= 0xF4)
+		{
+			length = 4;
+			second_min = lead == 0xF0 ? 0x90 : 0x80;
+			second_max = lead == 0xF4 ? 0x8F : 0xBF;
+		}
+		else
+		{
+			return false;
+		}
+		if (end_ - pos_ < length)
+		{
+			return false;
+		}
+		for (int i = 1; i < length; i++)
+		{
+			const uint8_t byte = pos_[i];
+			if (byte < (i == 1 ? second_min : 0x80) || byte > (i == 1 ? second_max : 0xBF))
+			{
+				return false;
+			}
+		}
+		pos_ += length;
+		return true;
+	}
+
+	bool read_hex4(uint32_t &value)
+	{
+		if (end_ - pos_ < 4)
+		{
+			return false;
+		}
+		value = 0;
+		for (int i = 0; i < 4; i++)
+		{
+			const char c = *pos_++;
+			value <<= 4;
+			if (c >= '0' && c <= '9')
+				value |= c - '0';
+			else if (c >= 'a' && c <= 'f')
+				value |= c - 'a' + 10;
+			else if (c >= 'A' && c <= 'F')
+				value |= c - 'A' + 10;
+			else
+				return false;
+		}
+		return true;
+	}
+
+	static void append_utf8(std::string &out, uint32_t code_point)
+	{
+		if (code_point < 0x80)
+		{
+			out += char(code_point);
+		}
+		else if (code_point < 0x800)
+		{
+			out += char(0xC0 | code_point >> 6);
+			out += char(0x80 | (code_point & 0x3F));
+		}
+		else if (code_point < 0x10000)
+		{
+			out += char(0xE0 | code_point >> 12);
+			out += char(0x80 | (code_point >> 6 & 0x3F));
+			out += char(0x80 | (code_point & 0x3F));
+		}
+		else
+		{
+			out += char(0xF0 | code_point >> 18);
+			out += char(0x80 | (code_point >> 12 & 0x3F));
+			out += char(0x80 | (code_point >> 6 & 0x3F));
+			out += char(0x80 | (code_point & 0x3F));
+		}
+	}
+
+	// pos_ is on the backslash
+	bool read_escape(std::string *out)
+	{
+		if (++pos_ == end_)
+		{
+			return false;
+		}
+		char decoded;
+		switch (*pos_++)
+		{
+		case '"': decoded = '"'; break;
+		case '\\': decoded = '\\'; break;
+		case '/': decoded = '/'; break;
+		case 'b': decoded = '\b'; break;
+		case 'f': decoded = '\f'; break;
+		case 'n': decoded = '\n'; break;
+		case 'r': decoded = '\r'; break;
+		case 't': decoded = '\t'; break;
+		case 'u':
+		{
+			uint32_t code_point;
+			if (!read_hex4(code_point) || (code_point >= 0xDC00 && code_point <= 0xDFFF))
+			{
+				return false;
+			}
+			if (code_point >= 0xD800 && code_point <= 0xDBFF)
+			{
+				// a high surrogate has to be followed by an escaped low surrogate
+				uint32_t low;
+				if (end_ - pos_ < 2 || pos_[0] != '\\' || pos_[1] != 'u')
+				{
+					return false;
+				}
+				pos_ += 2;
+				if (!read_hex4(low) || low < 0xDC00 || low > 0xDFFF)
+				{
+					return false;
+				}
+				code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+			}
+			if (out)
+			{
+				append_utf8(*out, code_point);
+			}
+			return true;
+		}
+		default:
+			return false;
+		}
+		if (out)
+		{
+			*out += decoded;
+		}
+		return true;
+	}
+
+	// reads a string up to and including its closing quote, decoding it into out if given
+	bool read_string(std::string *out)
+	{
+		while (true)
+		{
+			const char *plain = pos_;
+			skip_plain_bytes();
+			if (out)
+			{
+				out->append(plain, pos_);
+			}
+			if (pos_ == end_)
+			{
+				return false;
+			}
+			const uint8_t c = *pos_;
+			if (c == '"')
+			{
+				++pos_;
+				return true;
+			}
+			if (c == '\\')
+			{
+				if (!read_escape(out))
+				{
+					return false;
+				}
+				continue;
+			}
+			if (c < 0x20)
+			{
+				return false;
+			}
+			const char *code_point = pos_;
+			if (!skip_utf8())
+			{
+				return false;
+			}
+			if (out)
+			{
+				out->append(code_point, pos_);
+			}
+		}
+	}
+
+	bool skip_digits()
+	{
+		const char *start = pos_;
+		while (pos_ != end_ && *pos_ >= '0' && *pos_ <= '9')
+		{
+			++pos_;
+		}
+		return pos_ != start;
+	}
+
+	bool skip_number()
+	{
+		const char *start = pos_;
+		bool exponent = false;
+		if (pos_ != end_ && *pos_ == '-')
+		{
+			++pos_;
+		}
+		if (pos_ != end_ && *pos_ == '0')
+		{
+			++pos_;
+		}
+		else if (!skip_digits())
+		{
+			return false;
+		}
+		if (pos_ != end_ && *pos_ == '.')
+		{
+			++pos_;
+			if (!skip_digits())
+			{
+				return false;
+			}
+		}
+		if (pos_ != end_ && (*pos_ == 'e' || *pos_ == 'E'))
+		{
+			++pos_;
+			exponent = true;
+			if (pos_ != end_ && (*pos_ == '+' || *pos_ == '-'))
+			{
+				++pos_;
+			}
+			if (!skip_digits())
+			{
+				return false;
+			}
+		}
+		// full parsers reject numbers that overflow a double
+		if (exponent || pos_ - start > 300)
+		{
+			return std::isfinite(std::strtod(std::string(start, pos_).c_str(), nullptr));
+		}
+		return true;
+	}
+
+	bool skip_literal(std::string_view literal)
+	{
+		if (std::string_view(pos_, end_ - pos_).substr(0, literal.size()) != literal)
+		{
+			return false;
+		}
+		pos_ += literal.size();
+		return true;
+	}
+
+	bool skip_value(int depth)
+	{
+		skip_whitespace();
+		if (pos_ == end_)
+		{
+			return false;
+		}
+		switch (*pos_)
+		{
+		case '"':
+			++pos_;
+			return read_string(nullptr);
+		case '{':
+			++pos_;
+			return read_object(depth + 1, false);
+		case '[':
+			++pos_;
+			return read_array(depth + 1);
+		case 't':
+			return skip_literal("true");
+		case 'f':
+			return skip_literal("false");
+		case 'n':
+			return skip_literal("null");
+		default:
+			return skip_number();
+		}
+	}
+
+	bool read_array(int depth)
+	{
+		if (depth > max_depth)
+		{
+			return false;
+		}
+		if (consume(']'))
+		{
+			return true;
+		}
+		do
+		{
+			if (!skip_value(depth))
+			{
+				return false;
+			}
+		} while (consume(','));
+		return consume(']');
+	}
+
+	// the keys of the top-level object are decoded and compared against the field
+	bool read_object(int depth, bool top_level)
+	{
+		if (depth > max_depth)
+		{
+			return false;
+		}
+		if (consume('}'))
+		{
+			return true;
+		}
+		do
+		{
+			key_.clear();
+			if (!consume('"') || !read_string(top_level ? &key_ : nullptr) || !consume(':'))
+			{
+				return false;
+			}
+			if (top_level && key_ == field_)
+			{
+				// like a full parser, a repeated field overrides the earlier ones
+				skip_whitespace();
+				if (pos_ != end_ && *pos_ == '"')
+				{
+					++pos_;
+					value_.emplace();
+					if (!read_string(&*value_))
+					{
+						return false;
+					}
+					continue;
+				}
+				value_.reset();
+			}
+			else if (top_level && !number_field_.empty() && key_ == number_field_)
+			{
+				skip_whitespace();
+				const char *start = pos_;
+				if (!skip_value(depth))
+				{
+					return false;
+				}
+				number_.reset();
+				if (*start == '-' || (*start >= '0' && *start <= '9'))
+				{
+					number_ = std::strtod(std::string(start, pos_).c_str(), nullptr);
+				}
+				continue;
+			}
+			if (!skip_value(depth))
+			{
+				return false;
+			}
+		} while (consume(','));
+		return consume('}');
+	}
+
+public:
+	json_field_scanner(std::string_view json, std::string_view field, std::string_view number_field = {})
+		: pos_(json.data()), end_(json.data() + json.size()), field_(field), number_field_(number_field)
+	{
+	}
+
+	// the field's value, or std::nullopt if the document is not a valid object (or nested too deeply),
+	// or if the field is missing or not a string
+	std::optional<std::string> extract()
+	{
+		if (!consume('{') || !read_object(1, true))
+		{
+			return std::nullopt;
+		}
+		skip_whitespace();
+		if (pos_ != end_)
+		{
+			return std::nullopt;
+		}
+		return std::move(value_);
+	}
+
+	// the number field's value after a successful extract, std::nullopt if it is missing or not a number
+	std::optional<double> number() const
+	{
+		return number_;
+	}
+};
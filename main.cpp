@@ -3,6 +3,10 @@
 #include <functional>
 #include <string>
 #include <unordered_set>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <pthread.h>
 
 #include "httplib.h"
 #include "json.hpp"
@@ -11,14 +15,19 @@
 #include "util.h"
 #include "handlers.h"
 #include "dataset.h"
+#include "json_field.h"
+#include "snapshot.h"
+#include "request_log.h"
+#include "metrics.h"
+#include "result_cache.h"
+#include "typeahead_sessions.h"
 
 #define RETURN_IF_QUIT(x) if (quit) return x 
-#define PRINT_USAGE(argv0) std::cerr << "Usage: " << argv0 << " DATASET... [-p PORT] [-nf NAME_FIELD] [-l RESULT_LIMIT] [-bc BUCKET_CAPACITY] [-bi | -tri | -tetra] [-fl] [-disk] [-dc]" << std::endl
+#define PRINT_USAGE(argv0) std::cerr << "Usage: " << argv0 << " DATASET... [-p PORT] [-nf NAME_FIELD] [-sf SCORE_FIELD] [-l RESULT_LIMIT] [-bc BUCKET_CAPACITY] [-tl TRIE_LENGTH] [-bi | -tri | -tetra] [-fl] [-disk | -mmap] [-dc] [-cp] [-snapshot PATH] [-log off|sampled|all] [-log-sample N] [-slow-query MS] [-cache MB] [-sessions N]" << std::endl
 
 std::atomic_bool quit = false;
 
 httplib::Server server;
-std::vector<std::unique_ptr<dataset>> datasets;
 
 void signal_handler(int signal)
 {
@@ -30,21 +39,65 @@ void signal_handler(int signal)
 	}
 }
 
+// snapshots hold it byte for byte, so it has no padding that could differ between runs
 struct dataset_entry
 {
 	dataset::element_id element_id;
+	// completions are ranked by it, see the score field
+	float score;
 	uint16_t dataset_id;
-	dataset_entry(dataset::element_id element_id = 0, uint16_t dataset_id = 0)
-		: element_id(element_id), dataset_id(dataset_id)
+	uint16_t unused = 0;
+	dataset_entry(dataset::element_id element_id = 0, uint16_t dataset_id = 0, float score = 0)
+		: element_id(element_id), score(score), dataset_id(dataset_id)
 	{
 	}
-	friend std::ostream& operator<<(std::ostream& os, const dataset_entry& dse)
+};
+
+// everything requests read from. a reload builds a new state while the old one keeps serving,
+// requests that already started finish on the state they picked up
+struct search_state
+{
+	using entry_type = dataset_entry;
+
+	fuzzy::sorted_database<dataset_entry> database;
+	std::vector<std::unique_ptr<dataset>> datasets;
+	unsigned element_count = 0;
+	bool from_snapshot = false;
+	// fuzzy completions of queries up to this many characters walk the trie instead of using the n-gram index
+	size_t trie_query_length = 0;
+	// locks internally. a reload comes with a new, empty cache
+	mutable result_cache<dataset_entry> cache;
+	// the same goes for the typeahead sessions, a session starts over after a reload
+	mutable typeahead_sessions sessions;
+
+	search_state(int ngram_size, size_t result_limit, bool first_letter_opt, uint64_t max_bucket_size, bool compressed_postings, size_t cache_budget, size_t session_count)
+		: database(ngram_size, result_limit, first_letter_opt, max_bucket_size, compressed_postings), cache(cache_budget), sessions(session_count)
 	{
-		os << datasets[dse.dataset_id]->get_element(dse.element_id);
-		return os;
+	}
+
+	std::string_view get_element(const dataset_entry &entry, std::string &buffer) const
+	{
+		return datasets[entry.dataset_id]->get_element(entry.element_id, buffer);
 	}
 };
 
+// the state requests are served from. it is frozen once built, reloads replace it as a whole
+std::shared_ptr<const search_state> current_state;
+std::mutex current_state_mutex;
+
+// what the last reload took
+struct reload_report
+{
+	unsigned count = 0;
+	uint64_t load_time = 0;
+	uint64_t swap_time = 0;
+	// the highest resident memory during the reload, in KiB
+	uint64_t peak_memory = 0;
+} last_reload;
+
+// started when a request is routed, read once its response is written. both happen on the thread serving the request
+thread_local timer request_timer;
+
 
 int main(int argc, char const *argv[])
 {
@@ -57,12 +110,21 @@ int main(int argc, char const *argv[])
 	// process args
 	int port = 8080;
 	int ngram_size = 2;
-	bool keep_elements_in_memory = true;
+	dataset::storage element_storage = dataset::storage::memory;
 	bool enforce_first_letter_match = false;
 	bool check_duplicates = false;
+	bool compress_postings = false;
 	int result_limit = 100;
 	long bucket_capacity = 1000;
+	long trie_length = 3;
 	const char* name_field = "name";
+	const char* score_field = "";
+	std::string snapshot_path;
+	request_log::verbosity log_verbosity = request_log::verbosity::all;
+	int log_sample_rate = 100;
+	int slow_query_time = 0;
+	long cache_size = 0;
+	long session_count = 1024;
 	std::vector<const char*> dataset_paths;
 	for (int i = 1; i < argc; i++)
 	{
@@ -84,7 +146,12 @@ int main(int argc, char const *argv[])
 		}
 		if (arg == "-disk")
 		{
-			keep_elements_in_memory = false;
+			element_storage = dataset::storage::disk;
+			continue;
+		}
+		if (arg == "-mmap")
+		{
+			element_storage = dataset::storage::mapped;
 			continue;
 		}
 		if (arg == "-fl" || arg == "-first-letter")
@@ -97,6 +164,11 @@ int main(int argc, char const *argv[])
 			check_duplicates = true;
 			continue;
 		}
+		if (arg == "-cp" || arg == "-compress-postings")
+		{
+			compress_postings = true;
+			continue;
+		}
 		if (arg == "-p" || arg == "-port")
 		{
 			if (i + 1 >= argc)
@@ -139,6 +211,18 @@ int main(int argc, char const *argv[])
 			++i;
 			continue;
 		}
+		if (arg == "-tl" || arg == "-trie-length")
+		{
+			if (i + 1 >= argc)
+			{
+				std::cerr << "Missing parameter for " << arg << std::endl;
+				PRINT_USAGE(argv[0]);
+				return 1;
+			}
+			trie_length = atol(argv[i + 1]);
+			++i;
+			continue;
+		}
 		if (arg == "-nf" || arg == "-name-field")
 		{
 			if (i + 1 >= argc)
@@ -151,6 +235,108 @@ int main(int argc, char const *argv[])
 			++i;
 			continue;
 		}
+		if (arg == "-sf" || arg == "-score-field")
+		{
+			if (i + 1 >= argc)
+			{
+				std::cerr << "Missing parameter for " << arg << std::endl;
+				PRINT_USAGE(argv[0]);
+				return 1;
+			}
+			score_field = argv[i + 1];
+			++i;
+			continue;
+		}
+		if (arg == "-snapshot")
+		{
+			if (i + 1 >= argc)
+			{
+				std::cerr << "Missing parameter for " << arg << std::endl;
+				PRINT_USAGE(argv[0]);
+				return 1;
+			}
+			snapshot_path = argv[i + 1];
+			++i;
+			continue;
+		}
+		if (arg == "-log")
+		{
+			if (i + 1 >= argc)
+			{
+				std::cerr << "Missing parameter for " << arg << std::endl;
+				PRINT_USAGE(argv[0]);
+				return 1;
+			}
+			const std::string level = argv[i + 1];
+			if (level == "off")
+				log_verbosity = request_log::verbosity::off;
+			else if (level == "sampled")
+				log_verbosity = request_log::verbosity::sampled;
+			else if (level == "all")
+				log_verbosity = request_log::verbosity::all;
+			else
+			{
+				std::cerr << "Invalid log verbosity \"" << level << '"' << std::endl;
+				PRINT_USAGE(argv[0]);
+				return 1;
+			}
+			++i;
+			continue;
+		}
+		if (arg == "-log-sample")
+		{
+			if (i + 1 >= argc)
+			{
+				std::cerr << "Missing parameter for " << arg << std::endl;
+				PRINT_USAGE(argv[0]);
+				return 1;
+			}
+			if (atoi(argv[i + 1]) <= 0)
+			{
+				std::cerr << "Invalid sample rate \"" << argv[i + 1] << '"' << std::endl;
+				PRINT_USAGE(argv[0]);
+				return 1;
+			}
+			log_sample_rate = atoi(argv[i + 1]);
+			++i;
+			continue;
+		}
+		if (arg == "-slow-query")
+		{
+			if (i + 1 >= argc)
+			{
+				std::cerr << "Missing parameter for " << arg << std::endl;
+				PRINT_USAGE(argv[0]);
+				return 1;
+			}
+			slow_query_time = atoi(argv[i + 1]);
+			++i;
+			continue;
+		}
+		if (arg == "-cache")
+		{
+			if (i + 1 >= argc)
+			{
+				std::cerr << "Missing parameter for " << arg << std::endl;
+				PRINT_USAGE(argv[0]);
+				return 1;
+			}
+			cache_size = atol(argv[i + 1]);
+			++i;
+			continue;
+		}
+		if (arg == "-sessions")
+		{
+			if (i + 1 >= argc)
+			{
+				std::cerr << "Missing parameter for " << arg << std::endl;
+				PRINT_USAGE(argv[0]);
+				return 1;
+			}
+			session_count = atol(argv[i + 1]);
+			++i;
+			continue;
+		}
 		if (arg[0] == '-')
 		{
 			std::cerr << "Invalid argument \"" << arg << '"' << std::endl;
@@ -165,139 +351,327 @@ int main(int argc, char const *argv[])
 		return 1;
 	}
 
-	fuzzy::sorted_database<dataset_entry> database(ngram_size, result_limit > 0 ? result_limit : SIZE_MAX, enforce_first_letter_match, bucket_capacity > 0 ? bucket_capacity : UINT64_MAX);
 	timer init_timer;
 
 	std::signal(SIGINT, signal_handler);
-	server.Get("/fuzzy", fuzzy_handler(database));
-	server.Get("/fuzzy/list", fuzzy_list_handler(database));
-	server.Get("/fuzzycomplete", fuzzycomplete_handler(database));
-	server.Get("/fuzzycomplete/list", fuzzycomplete_list_handler(database));
-	server.Get("/exact", exact_handler(database));
-	server.Get("/exact/list", exact_list_handler(database));
-	server.Get("/complete", completion_handler(database));
-	server.Get("/complete/list", completion_list_handler(database));
+	// SIGHUP reloads the datasets. it is blocked before any thread starts, so only the reload thread receives it
+	sigset_t reload_signals;
+	sigemptyset(&reload_signals);
+	sigaddset(&reload_signals, SIGHUP);
+	pthread_sigmask(SIG_BLOCK, &reload_signals, nullptr);
+
+	// started after blocking SIGHUP, so the flusher thread doesn't catch it
+	request_log access_log(log_verbosity, log_sample_rate, slow_query_time > 0 ? slow_query_time * 1000ull : 0);
+
+	const state_source<search_state> source = []
+	{
+		std::lock_guard lock(current_state_mutex);
+		return current_state;
+	};
+	// every search endpoint has a batch variant, the searches of a batch count towards the search endpoint.
+	// the request thread works along, so one less worker keeps a single batch at one thread per core
+	worker_pool batch_workers(fuzzy::internal::build_threads() - 1);
+	server_metrics metrics;
+	const auto add_search_endpoint = [&](const std::string &path, httplib::Server::Handler (*make_handler)(state_source<search_state>, request_log &, endpoint_metrics &))
+	{
+		const auto handler = make_handler(source, access_log, metrics.add_endpoint(path));
+		server.Get(path, handler);
+		metrics.add_endpoint(path + "/batch");
+		server.Post(path + "/batch", batch_handler(handler, batch_workers));
+	};
+	add_search_endpoint("/fuzzy", fuzzy_handler);
+	add_search_endpoint("/fuzzy/list", fuzzy_list_handler);
+	add_search_endpoint("/fuzzycomplete", fuzzycomplete_handler);
+	add_search_endpoint("/fuzzycomplete/list", fuzzycomplete_list_handler);
+	add_search_endpoint("/exact", exact_handler);
+	add_search_endpoint("/exact/list", exact_list_handler);
+	add_search_endpoint("/complete", completion_handler);
+	add_search_endpoint("/complete/list", completion_list_handler);
+	server.set_pre_routing_handler([](const auto&, auto&) {
+		request_timer.reset();
+		return httplib::Server::HandlerResponse::Unhandled;
+	});
+	server.set_logger([&](const auto& req, const auto& res) {
+		endpoint_metrics *endpoint = metrics.find(req.path);
+		if (endpoint && req.method != "OPTIONS")
+			endpoint->observe_response(res.status, request_timer.get<std::chrono::microseconds>());
+	});
 	server.set_post_routing_handler([](const auto&, auto& res) {
 		res.set_header("Access-Control-Allow-Origin", "*");
 		return true;
 	});
 	server.Options(".*", [](const auto&, auto& res) {
 		res.set_header("Access-Control-Allow-Origin", "*");
-		res.set_header("Access-Control-Allow-Methods", "GET");
-		res.set_header("Access-Control-Allow-Headers", "Content-Type");
+		res.set_header("Access-Control-Allow-Methods", "GET, POST");
+		res.set_header("Access-Control-Allow-Headers", "Content-Type, X-Debug-Trace");
 	});
 
 	std::cout << "port set to " << port << std::endl;
 	std::cout << "name field set to \"" << name_field << "\"" << std::endl;
+	if (*score_field)
+		std::cout << "ranking completions by the \"" << score_field << "\" field" << std::endl;
 	std::cout << "max page size set to " << (result_limit > 0 ? std::to_string(result_limit) : "unlimited") << std::endl;
 	std::cout << "bucket capacity set to " << (bucket_capacity > 0 ? std::to_string(bucket_capacity) : "unlimited") << std::endl;
+	if (trie_length > 0)
+		std::cout << "searching fuzzy completions of up to " << trie_length << " characters in the trie" << std::endl;
 	std::cout << "using " << (ngram_size == 2 ? "bigrams" : (ngram_size == 3 ? "trigrams" : "tetragrams")) << std::endl;
 	if (enforce_first_letter_match)
 		std::cout << "enforcing first letter match for fuzzy search" << std::endl;
-	if (keep_elements_in_memory)
+	if (element_storage == dataset::storage::memory)
 		std::cout << "using in-memory mode" << std::endl;
+	else if (element_storage == dataset::storage::mapped)
+		std::cout << "using memory-mapped mode: do not modify dataset files while the program is running!" << std::endl;
 	else
 		std::cout << "using disk mode: do not modify dataset files while the program is running!" << std::endl;
 	if (check_duplicates)
 		std::cout << "entry duplication check enabled" << std::endl;
+	if (compress_postings)
+		std::cout << "using compressed posting lists" << std::endl;
+	if (log_verbosity == request_log::verbosity::off)
+		std::cout << "request logging disabled" << std::endl;
+	else if (log_verbosity == request_log::verbosity::sampled)
+		std::cout << "logging every " << log_sample_rate << ". request per thread" << std::endl;
+	if (slow_query_time > 0)
+		std::cout << "logging requests slower than " << slow_query_time << "ms" << std::endl;
+	if (cache_size > 0)
+		std::cout << "caching results in up to " << cache_size << "MB" << std::endl;
+	if (session_count <= 0)
+		std::cout << "typeahead sessions disabled" << std::endl;
 	std::cout << std::endl;
 
 
-	unsigned dataset_count = 0;
-	unsigned total_element_count = 0;
-	unsigned current_dataset_element_count = 0;
-	unsigned current_dataset_duplicates = 0;
+	// loads the datasets and builds a database from them, or loads both from the snapshot.
+	// returns nullptr if a dataset file broke while parsing, or if the server is quitting
+	const auto load_state = [&]() -> std::shared_ptr<search_state>
+	{
+		auto state = std::make_shared<search_state>(ngram_size, result_limit > 0 ? result_limit : SIZE_MAX, enforce_first_letter_match, bucket_capacity > 0 ? bucket_capacity : UINT64_MAX, compress_postings, cache_size > 0 ? cache_size << 20 : 0, std::max(0L, session_count));
+		state->trie_query_length = std::max(0L, trie_length);
+		unsigned current_dataset_element_count = 0;
+		unsigned current_dataset_duplicates = 0;
+
+		// the snapshot only depends on options that change the database contents
+		const std::string fingerprint = snapshot_path.empty() ? std::string() : snapshot_fingerprint(dataset_paths,
+			"ngram size " + std::to_string(ngram_size) + ", bucket capacity " + std::to_string(bucket_capacity)
+			+ ", compressed postings " + std::to_string(compress_postings) + ", name field " + name_field + ", score field " + score_field
+			+ ", duplicate check " + std::to_string(check_duplicates));
+		if (!snapshot_path.empty())
+		{
+			timer snapshot_timer;
+			state->from_snapshot = load_snapshot(snapshot_path, fingerprint, state->database, state->datasets, dataset_paths, element_storage);
+			if (state->from_snapshot)
+			{
+				state->element_count = state->database.size();
+				std::cout << "loaded " << state->element_count << " elements from " << state->datasets.size() << " datasets from snapshot \"" << snapshot_path << "\" in " << snapshot_timer.get() << "ms" << std::endl;
+			}
+			else
+			{
+				std::cout << "snapshot \"" << snapshot_path << "\" is missing or outdated, rebuilding it" << std::endl;
+			}
+		}
 
-	std::unordered_set<size_t> element_hashset; 
-	std::function<void(dataset::element_id, const std::string&)> element_handler =
-		[&](dataset::element_id id, const std::string &str)
+		if (!state->from_snapshot)
 		{
-			try
+			std::unordered_set<size_t> element_hashset; 
+			dataset::element_parser element_parser =
+				[&](std::string_view str, dataset::parsed_element &element)
+				{
+					// the full parser only sees lines the scanner can't handle, and reports their errors
+					json_field_scanner scanner(str, name_field, score_field);
+					if (auto name = scanner.extract())
+					{
+						element.name = std::move(*name);
+						element.score = scanner.number().value_or(0);
+						return;
+					}
+					auto json = nlohmann::json::parse(str);
+					element.name = json[name_field].template get<std::string>();
+					if (*score_field && json[score_field].is_number())
+						element.score = json[score_field].template get<double>();
+				};
+			dataset::element_handler element_handler =
+				[&](dataset::element_id id, std::string_view str, dataset::parsed_element &&element)
+				{
+					if (!element.error.empty())
+					{
+						if (!str.empty())
+						{
+							std::cerr << "error while parsing line " << id << ": " << element.error << std::endl;
+						}
+						return;
+					}
+					state->database.add(element.name, dataset_entry{id, uint16_t(state->datasets.size()), element.score});
+					++current_dataset_element_count;
+				};
+			if (check_duplicates)
 			{
-				auto json = nlohmann::json::parse(str);
-				database.add(json[name_field].template get<std::string>(), dataset_entry{id, uint16_t(datasets.size())});
-				++current_dataset_element_count;
+				element_handler =
+					[&, base_handler = element_handler, hasher = std::hash<std::string_view>{}]
+					(dataset::element_id id, std::string_view str, dataset::parsed_element &&element)
+					{
+						if (element_hashset.insert(hasher(str)).second) [[likely]]
+							base_handler(id, str, std::move(element));
+						else
+							++current_dataset_duplicates;
+					};
 			}
-			catch (const std::exception &e)
+
+			// process datasets
+			for (const char* path : dataset_paths)
 			{
-				if (!str.empty())
+				timer parse_timer;
+				std::cout << "parsing dataset \"" << path << '"' << std::endl;
+				auto new_dataset = std::make_unique<dataset>(path, element_storage, quit, element_parser, element_handler);
+				RETURN_IF_QUIT(nullptr);
+				if (new_dataset->ready())
+				{
+					std::error_code size_error;
+					const uintmax_t file_size = std::filesystem::file_size(path, size_error);
+					std::cout << "parsed " << current_dataset_element_count << " entries in " << parse_timer.get() << "ms";
+					if (!size_error) std::cout << " (" << file_size / 1000 / std::max<uint64_t>(parse_timer.get(), 1) << " MB/s)";
+					if (current_dataset_duplicates > 0) std::cout << " (" << current_dataset_duplicates << " duplicates)";
+					std::cout << std::endl;
+					state->datasets.push_back(std::move(new_dataset));
+					state->element_count += current_dataset_element_count;
+				}
+				else if (current_dataset_element_count > 0)
 				{
-					std::cerr << "error while parsing line " << id << ": " << e.what() << std::endl;
+					// A file error occurred during parsing.
+					// We don't want entries from broken files in our
+					// database, but we can't get them out anymore.
+					return nullptr; // ...So we abort
 				}
+				current_dataset_element_count = 0;
+				current_dataset_duplicates = 0;
 			}
-		};
-	if (check_duplicates)
-	{
-		element_handler =
-			[&, base_handler = element_handler, hasher = std::hash<std::string>{}]
-			(dataset::element_id id, const std::string &str)
+			element_hashset = std::unordered_set<size_t>();
+			std::cout << "processed " << state->element_count << " elements from " << state->datasets.size() << "/" << dataset_paths.size() << " datasets" << std::endl;
+
+			std::cout << "preparing database" << std::endl;
+			timer db_init_timer;
+			state->database.build();
+			RETURN_IF_QUIT(nullptr);
+			std::cout << "database prepared in " << db_init_timer.stop().get() << "ms" << std::endl;
+			for (const auto &[phase, milliseconds] : state->database.last_build_timings())
 			{
-				if (element_hashset.insert(hasher(str)).second) [[likely]]
-					base_handler(id, str);
+				std::cout << "  " << phase << ": " << milliseconds << "ms" << std::endl;
+			}
+			if (!snapshot_path.empty())
+			{
+				timer snapshot_timer;
+				if (save_snapshot(snapshot_path, fingerprint, state->database, state->datasets))
+					std::cout << "saved snapshot \"" << snapshot_path << "\" in " << snapshot_timer.get() << "ms" << std::endl;
 				else
-					++current_dataset_duplicates;
-			};
+					std::cerr << "could not save snapshot \"" << snapshot_path << '"' << std::endl;
+			}
+		}
+		std::cout << "index uses " << state->database.index().memory_usage() / 1024 << "KiB for " << state->database.index().posting_count() << " postings" << std::endl;
+		std::cout << "completion trie uses " << state->database.trie_memory_usage() / 1024 << "KiB" << std::endl;
+		return state;
+	};
+
+	current_state = load_state();
+	if (!current_state)
+	{
+		return quit ? 0 : 1;
 	}
+	std::cout << "\ninitialization took " << init_timer.stop().get() << "ms" << std::endl;
 
-	// process datasets
-	for (const char* path : dataset_paths)
+	std::thread reload_thread([&]
 	{
-		timer parse_timer;
-		std::cout << "parsing dataset \"" << path << '"' << std::endl;
-		auto new_dataset = std::make_unique<dataset>(path, keep_elements_in_memory, quit, element_handler);
-		RETURN_IF_QUIT(0);
-		if (new_dataset->ready())
+		int signal;
+		while (sigwait(&reload_signals, &signal) == 0 && !quit)
 		{
-			std::cout << "parsed " << current_dataset_element_count << " entries in " << parse_timer.get() << "ms";
-			if (current_dataset_duplicates > 0) std::cout << " (" << current_dataset_duplicates << " duplicates)";
-			std::cout << std::endl;
-			datasets.push_back(std::move(new_dataset));
-			++dataset_count;
-			total_element_count += current_dataset_element_count;
-		}
-		else if (current_dataset_element_count > 0)
-		{
-			// A file error occurred during parsing.
-			// We don't want entries from broken files in our
-			// database, but we can't get them out anymore.
-			return 1; // ...So we abort
+			std::cout << "SIGHUP received\nreloading datasets" << std::endl;
+			// so the peak is the reload's own, not one of an earlier load
+			reset_peak_memory_usage();
+			timer reload_timer;
+			std::shared_ptr<const search_state> state = load_state();
+			if (!state)
+			{
+				std::cerr << "reload failed, still serving the previous datasets" << std::endl;
+				continue;
+			}
+			const uint64_t load_time = reload_timer.get();
+			timer swap_timer;
+			{
+				std::lock_guard lock(current_state_mutex);
+				std::swap(current_state, state);
+				last_reload = {last_reload.count + 1, load_time, swap_timer.get<std::chrono::microseconds>(), peak_memory_usage()};
+			}
+			// requests still running on the old state keep it alive, the last one of them frees it
+			state.reset();
+			std::cout << "reloaded in " << load_time << "ms, swapped in " << last_reload.swap_time << "us (peak memory "
+				<< last_reload.peak_memory / 1024 << "MiB, now " << memory_usage() / 1024 << "MiB)" << std::endl;
 		}
-		current_dataset_element_count = 0;
-		current_dataset_duplicates = 0;
-	}
-	element_hashset = std::unordered_set<size_t>();
-	std::cout << "processed " << total_element_count << " elements from " << dataset_count << "/" << dataset_paths.size() << " datasets" << std::endl;
-
-	std::cout << "preparing database" << std::endl;
-	timer db_init_timer;
-	database.build();
-	RETURN_IF_QUIT(0);
-	std::cout << "database prepared in " << db_init_timer.stop().get() << "ms" << std::endl;
-
-	std::cout << "\ninitialization took " << init_timer.stop().get() << "ms" << std::endl;
+	});
 
 	server.Get("/info", [&](const auto &, httplib::Response &res) {
+		const auto state = source();
+		const auto cache_stats = state->cache.stats();
+		std::lock_guard lock(current_state_mutex);
 		res.set_content(
 			nlohmann::json({
 				{"ngramSize", ngram_size},
-				{"inMemory", keep_elements_in_memory},
+				{"inMemory", element_storage == dataset::storage::memory},
+				{"memoryMapped", element_storage == dataset::storage::mapped},
 				{"duplicateCheck", check_duplicates},
+				{"compressedPostings", compress_postings},
 				{"firstLetterMatch", enforce_first_letter_match},
 				{"resultLimit", result_limit},
-				{"datasetCount", dataset_count},
-				{"elementCount", total_element_count},
-				{"startupTime", init_timer.get()}
+				{"datasetCount", state->datasets.size()},
+				{"elementCount", state->element_count},
+				{"startupTime", init_timer.get()},
+				{"fromSnapshot", state->from_snapshot},
+				{"indexMemory", state->database.index().memory_usage()},
+				{"indexPostings", state->database.index().posting_count()},
+				{"indexDecodeRate", state->database.index().decode_rate()},
+				{"trieMemory", state->database.trie_memory_usage()},
+				{"trieQueryLength", trie_length},
+				{"reloadCount", last_reload.count},
+				{"reloadTime", last_reload.load_time},
+				{"reloadSwapTime", last_reload.swap_time},
+				{"reloadPeakMemory", last_reload.peak_memory},
+				{"cacheMemory", cache_stats.memory},
+				{"cacheEntries", cache_stats.entries},
+				{"cacheHits", cache_stats.hits},
+				{"cacheMisses", cache_stats.misses},
+				{"cacheRejections", cache_stats.rejections},
+				{"cacheEvictions", cache_stats.evictions},
+				{"typeaheadSessions", state->sessions.size()}
 			}).dump(4),
 			"application/json"
 		);
 	});
 
+	server.Get("/metrics", [&](const auto &, httplib::Response &res) {
+		const auto state = source();
+		std::stringstream out;
+		metrics.write(out);
+		const auto gauge = [&](const char *name, const char *type, const char *help, uint64_t value)
+		{
+			out << "# HELP " << name << ' ' << help << "\n# TYPE " << name << ' ' << type << '\n' << name << ' ' << value << '\n';
+		};
+		gauge("fuzzy_elements", "gauge", "Elements in the database.", state->element_count);
+		gauge("fuzzy_index_memory_bytes", "gauge", "Approximate heap memory of the n-gram index.", state->database.index().memory_usage());
+		gauge("fuzzy_index_postings", "gauge", "Postings in the n-gram index.", state->database.index().posting_count());
+		gauge("fuzzy_resident_memory_bytes", "gauge", "Resident memory of the process.", memory_usage() * 1024);
+		gauge("fuzzy_request_log_dropped_total", "counter", "Request log records dropped because the log couldn't keep up.", access_log.dropped());
+		{
+			std::lock_guard lock(current_state_mutex);
+			gauge("fuzzy_reloads_total", "counter", "Completed reloads.", last_reload.count);
+		}
+		res.set_content(out.str(), "text/plain; version=0.0.4");
+	});
+
 	std::cout << "\nstarting server on port " << port << std::endl;
 	if (!server.listen("0.0.0.0", port))
 	{
 		std::cerr << "failed to start server" << std::endl;
 	}
 
-	datasets.clear();
+	// wake the reload thread up so it sees the quit flag
+	quit = true;
+	pthread_kill(reload_thread.native_handle(), SIGHUP);
+	reload_thread.join();
 	return 0;
 }
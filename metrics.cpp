@@ -0,0 +1,125 @@
+#include "metrics.h"
+
+#include <algorithm>
+
+
+histogram::histogram(std::vector<uint64_t> bounds)
+	: bounds_(std::move(bounds)), counts_(new std::atomic<uint64_t>[bounds_.size() + 1])
+{
+	for (size_t i = 0; i <= bounds_.size(); i++)
+	{
+		counts_[i] = 0;
+	}
+}
+
+void histogram::observe(uint64_t value)
+{
+	const size_t bucket = std::lower_bound(bounds_.begin(), bounds_.end(), value) - bounds_.begin();
+	counts_[bucket].fetch_add(1, std::memory_order_relaxed);
+	sum_.fetch_add(value, std::memory_order_relaxed);
+}
+
+void histogram::write(std::ostream &os, std::string_view name, std::string_view labels) const
+{
+	// prometheus buckets are cumulative
+	uint64_t count = 0;
+	for (size_t i = 0; i <= bounds_.size(); i++)
+	{
+		count += counts_[i].load(std::memory_order_relaxed);
+		os << name << "_bucket{" << labels << ",le=\"";
+		if (i < bounds_.size())
+			os << bounds_[i];
+		else
+			os << "+Inf";
+		os << "\"} " << count << '\n';
+	}
+	os << name << "_sum{" << labels << "} " << sum_.load(std::memory_order_relaxed) << '\n';
+	os << name << "_count{" << labels << "} " << count << '\n';
+}
+
+std::vector<uint64_t> one_two_five_buckets(uint64_t first, uint64_t last)
+{
+	std::vector<uint64_t> bounds;
+	for (uint64_t magnitude = first; magnitude <= last; magnitude *= 10)
+	{
+		for (uint64_t factor : {1, 2, 5})
+		{
+			if (magnitude * factor <= last)
+				bounds.push_back(magnitude * factor);
+		}
+	}
+	return bounds;
+}
+
+endpoint_metrics::endpoint_metrics(std::string name)
+	: name(std::move(name)),
+	  latency(one_two_five_buckets(10, 10000000)),
+	  candidates(one_two_five_buckets(1, 1000000)),
+	  verifications(one_two_five_buckets(1, 1000000))
+{
+}
+
+void endpoint_metrics::observe_response(int status, uint64_t microseconds)
+{
+	requests.fetch_add(1, std::memory_order_relaxed);
+	if (status >= 400)
+	{
+		errors.fetch_add(1, std::memory_order_relaxed);
+	}
+	latency.observe(microseconds);
+}
+
+endpoint_metrics &server_metrics::add_endpoint(const std::string &name)
+{
+	auto &endpoint = endpoints_[name];
+	if (!endpoint)
+	{
+		endpoint = std::make_unique<endpoint_metrics>(name);
+	}
+	return *endpoint;
+}
+
+endpoint_metrics *server_metrics::find(std::string_view name)
+{
+	const auto endpoint = endpoints_.find(name);
+	return endpoint == endpoints_.end() ? nullptr : endpoint->second.get();
+}
+
+void server_metrics::write(std::ostream &os) const
+{
+	const auto label = [](const endpoint_metrics &endpoint)
+	{
+		return "endpoint=\"" + endpoint.name + '"';
+	};
+
+	os << "# HELP fuzzy_requests_total Requests served.\n";
+	os << "# TYPE fuzzy_requests_total counter\n";
+	for (const auto &[name, endpoint] : endpoints_)
+	{
+		os << "fuzzy_requests_total{" << label(*endpoint) << "} " << endpoint->requests.load(std::memory_order_relaxed) << '\n';
+	}
+	os << "# HELP fuzzy_request_errors_total Requests answered with a status of 400 or above.\n";
+	os << "# TYPE fuzzy_request_errors_total counter\n";
+	for (const auto &[name, endpoint] : endpoints_)
+	{
+		os << "fuzzy_request_errors_total{" << label(*endpoint) << "} " << endpoint->errors.load(std::memory_order_relaxed) << '\n';
+	}
+	os << "# HELP fuzzy_request_duration_microseconds Time from routing a request to writing its response.\n";
+	os << "# TYPE fuzzy_request_duration_microseconds histogram\n";
+	for (const auto &[name, endpoint] : endpoints_)
+	{
+		endpoint->latency.write(os, "fuzzy_request_duration_microseconds", label(*endpoint));
+	}
+	os << "# HELP fuzzy_search_candidates Elements sharing an n-gram with the query, per fuzzy search.\n";
+	os << "# TYPE fuzzy_search_candidates histogram\n";
+	for (const auto &[name, endpoint] : endpoints_)
+	{
+		endpoint->candidates.write(os, "fuzzy_search_candidates", label(*endpoint));
+	}
+	os << "# HELP fuzzy_search_verifications Elements whose distance to the query was computed, per fuzzy search.\n";
+	os << "# TYPE fuzzy_search_verifications histogram\n";
+	for (const auto &[name, endpoint] : endpoints_)
+	{
+		endpoint->verifications.write(os, "fuzzy_search_verifications", label(*endpoint));
+	}
+}
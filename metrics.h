@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <memory>
+#include <atomic>
+#include <ostream>
+
+// a histogram with fixed buckets that threads add to without locking
+class histogram
+{
+	// upper bounds of the buckets, the last bucket takes everything above
+	const std::vector<uint64_t> bounds_;
+	const std::unique_ptr<std::atomic<uint64_t>[]> counts_;
+	std::atomic<uint64_t> sum_ = 0;
+
+public:
+	explicit histogram(std::vector<uint64_t> bounds);
+
+	void observe(uint64_t value);
+	// writes the buckets, sum and count in the prometheus text format
+	void write(std::ostream &os, std::string_view name, std::string_view labels) const;
+};
+
+// 1, 2, 5, 10, 20, 50, ... from first up to last
+std::vector<uint64_t> one_two_five_buckets(uint64_t first, uint64_t last);
+
+// what the server tracks about one endpoint
+struct endpoint_metrics
+{
+	const std::string name;
+
+	std::atomic<uint64_t> requests = 0;
+	// responses with a status of 400 or above
+	std::atomic<uint64_t> errors = 0;
+	// from routing the request to writing the last byte of the response, in microseconds
+	histogram latency;
+	// per fuzzy search: elements sharing an n-gram with the query, and elements whose distance was computed
+	histogram candidates;
+	histogram verifications;
+
+	explicit endpoint_metrics(std::string name);
+
+	void observe_response(int status, uint64_t microseconds);
+};
+
+// metrics of all endpoints. endpoints are added while setting up the server, afterwards the set is fixed
+// and the metrics are only ever updated through atomics
+class server_metrics
+{
+	std::map<std::string, std::unique_ptr<endpoint_metrics>, std::less<>> endpoints_;
+
+public:
+	endpoint_metrics &add_endpoint(const std::string &name);
+	// nullptr if the endpoint isn't tracked
+	endpoint_metrics *find(std::string_view name);
+
+	// writes all endpoint metrics in the prometheus text format
+	void write(std::ostream &os) const;
+};
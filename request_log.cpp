@@ -0,0 +1,222 @@
+#include "request_log.h"
+
+#include <iostream>
+#include <array>
+#include <string>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+
+
+namespace
+{
+	// records a thread can have pending before it starts dropping them
+	constexpr size_t ring_capacity = 1024;
+	constexpr auto flush_interval = std::chrono::milliseconds(100);
+
+	std::atomic<uint64_t> next_log_id = 0;
+
+	void append_record(std::string &out, const request_record &record)
+	{
+		if (record.slow)
+		{
+			out += "slow ";
+		}
+		out += record.endpoint;
+		out += " q=\"";
+		for (const char *c = record.query; *c; c++)
+		{
+			if (*c == '"' || *c == '\\')
+			{
+				out += '\\';
+				out += *c;
+			}
+			else if (static_cast<unsigned char>(*c) < 0x20)
+			{
+				static constexpr char hex[] = "0123456789abcdef";
+				out += "\\x";
+				out += hex[*c >> 4];
+				out += hex[*c & 0xf];
+			}
+			else
+			{
+				out += *c;
+			}
+		}
+		if (record.query_length > strlen(record.query))
+		{
+			out += "...";
+		}
+		out += "\" length=" + std::to_string(record.query_length);
+		out += " candidates=" + std::to_string(record.candidates);
+		out += " verified=" + std::to_string(record.verified);
+		out += " distance=" + std::to_string(record.distance);
+		out += " results=" + std::to_string(record.results);
+		out += " time=" + std::to_string(record.microseconds) + "us";
+		if (record.slow)
+		{
+			out += " postings=" + std::to_string(record.postings);
+			out += " search=" + std::to_string(record.search_time) + "us";
+			out += " lookup=" + std::to_string(record.lookup_time) + "us";
+			out += " count=" + std::to_string(record.count_time) + "us";
+			out += " verify=" + std::to_string(record.verify_time) + "us";
+			out += " extract=" + std::to_string(record.extract_time) + "us";
+			out += " serialize=" + std::to_string(record.serialize_time) + "us";
+		}
+		out += '\n';
+	}
+}
+
+void request_record::set_query(std::string_view query_string)
+{
+	query_length = query_string.size();
+	size_t length = std::min(query_string.size(), sizeof(query) - 1);
+	// dont cut a utf-8 sequence in half
+	while (length < query_string.size() && length > 0 && (query_string[length] & 0xc0) == 0x80)
+	{
+		length--;
+	}
+	memcpy(query, query_string.data(), length);
+	query[length] = '\0';
+}
+
+// a single producer, single consumer queue. the owning thread appends at head, the flusher consumes at tail
+struct request_log::ring
+{
+	std::array<request_record, ring_capacity> records;
+	alignas(64) std::atomic<size_t> head = 0;
+	alignas(64) std::atomic<size_t> tail = 0;
+	// set once the owning thread is done with the ring, the flusher drops it after emptying it
+	std::atomic_bool orphaned = false;
+	// only touched by the owning thread
+	unsigned sample_counter = 0;
+};
+
+request_log::request_log(verbosity level, unsigned sample_rate, uint64_t slow_query_time)
+	: verbosity_(level), sample_rate_(std::max(1u, sample_rate)), slow_query_time_(slow_query_time), id_(next_log_id++)
+{
+	if (verbosity_ == verbosity::off && !slow_query_time_)
+	{
+		return;
+	}
+	flusher_ = std::thread([this]
+		{
+			std::unique_lock lock(flusher_mutex_);
+			while (!stopping_)
+			{
+				flusher_signal_.wait_for(lock, flush_interval, [this] { return stopping_; });
+				lock.unlock();
+				flush();
+				lock.lock();
+			}
+		});
+}
+
+request_log::~request_log()
+{
+	if (!flusher_.joinable())
+	{
+		return;
+	}
+	{
+		std::lock_guard lock(flusher_mutex_);
+		stopping_ = true;
+	}
+	flusher_signal_.notify_one();
+	flusher_.join();
+}
+
+request_log::ring &request_log::thread_ring()
+{
+	// marks the ring orphaned when the thread exits, so threads that come and go dont pile up rings
+	struct holder
+	{
+		uint64_t log_id = UINT64_MAX;
+		std::shared_ptr<request_log::ring> owned;
+		~holder()
+		{
+			if (owned)
+				owned->orphaned = true;
+		}
+	};
+	static thread_local holder current;
+
+	if (current.log_id != id_)
+	{
+		if (current.owned)
+			current.owned->orphaned = true;
+		current.owned = std::make_shared<ring>();
+		current.log_id = id_;
+		std::lock_guard lock(rings_mutex_);
+		rings_.push_back(current.owned);
+	}
+	return *current.owned;
+}
+
+void request_log::log(const request_record &record)
+{
+	if (verbosity_ == verbosity::off && !record.slow)
+	{
+		return;
+	}
+	ring &ring = thread_ring();
+	if (verbosity_ == verbosity::sampled && ring.sample_counter++ % sample_rate_ != 0 && !record.slow)
+	{
+		return;
+	}
+	const size_t head = ring.head.load(std::memory_order_relaxed);
+	if (head - ring.tail.load(std::memory_order_acquire) >= ring_capacity)
+	{
+		dropped_.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	ring.records[head % ring_capacity] = record;
+	ring.head.store(head + 1, std::memory_order_release);
+}
+
+uint64_t request_log::dropped() const
+{
+	return dropped_.load(std::memory_order_relaxed);
+}
+
+uint64_t request_log::slow_query_time() const
+{
+	return slow_query_time_;
+}
+
+void request_log::flush()
+{
+	// the list is copied, so threads adding their ring never wait for the output
+	std::vector<std::shared_ptr<ring>> rings;
+	{
+		std::lock_guard lock(rings_mutex_);
+		rings = rings_;
+	}
+
+	std::string out;
+	for (const auto &ring : rings)
+	{
+		const size_t head = ring->head.load(std::memory_order_acquire);
+		size_t tail = ring->tail.load(std::memory_order_relaxed);
+		for (; tail != head; tail++)
+		{
+			append_record(out, ring->records[tail % ring_capacity]);
+		}
+		ring->tail.store(tail, std::memory_order_release);
+	}
+	const uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+	if (dropped != reported_dropped_)
+	{
+		out += "dropped " + std::to_string(dropped - reported_dropped_) + " request log records\n";
+		reported_dropped_ = dropped;
+	}
+	if (!out.empty())
+	{
+		std::cout << out << std::flush;
+	}
+
+	// an orphaned ring gets no more records, so it can go once it is empty
+	std::lock_guard lock(rings_mutex_);
+	std::erase_if(rings_, [](const std::shared_ptr<ring> &ring)
+		{ return ring->orphaned && ring->tail.load() == ring->head.load(); });
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <memory>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+// a finished request, as it ends up in the log
+struct request_record
+{
+	// has to outlive the log, records only keep the pointer
+	const char *endpoint = "";
+	uint64_t microseconds = 0;
+	uint32_t query_length = 0;
+	// see fuzzy::query_stats. 0 for exact and completion searches
+	uint32_t candidates = 0;
+	uint32_t verified = 0;
+	// distance of the best result, -1 without results
+	int32_t distance = -1;
+	uint32_t results = 0;
+
+	// slow requests are always logged, along with their stages
+	bool slow = false;
+	uint32_t postings = 0;
+	// microseconds per stage. lookup, count and verify are the stages of a fuzzy search, and part of search
+	uint32_t search_time = 0;
+	uint32_t lookup_time = 0;
+	uint32_t count_time = 0;
+	uint32_t verify_time = 0;
+	uint32_t extract_time = 0;
+	uint32_t serialize_time = 0;
+
+	// the start of the query, zero terminated
+	char query[44] = {};
+
+	void set_query(std::string_view query_string);
+};
+
+// collects request records without ever making a request wait: every thread appends to a ring buffer of its own,
+// and a background thread empties the rings into stdout in batches. records that don't fit are dropped and counted.
+// slow requests are logged regardless of the verbosity
+class request_log
+{
+public:
+	enum class verbosity
+	{
+		off,
+		// every sample_rate-th request of a thread
+		sampled,
+		all,
+	};
+
+private:
+	struct ring;
+
+	const verbosity verbosity_;
+	const unsigned sample_rate_;
+	// in microseconds, 0 if slow requests aren't logged
+	const uint64_t slow_query_time_;
+	// tells the rings of different logs apart, so a thread never writes into the ring of a log that is gone
+	const uint64_t id_;
+
+	// only locked to add a ring (once per thread) and by the flusher
+	std::mutex rings_mutex_;
+	std::vector<std::shared_ptr<ring>> rings_;
+	std::atomic<uint64_t> dropped_ = 0;
+	// only touched by the flusher
+	uint64_t reported_dropped_ = 0;
+
+	std::mutex flusher_mutex_;
+	std::condition_variable flusher_signal_;
+	bool stopping_ = false;
+	std::thread flusher_;
+
+	ring &thread_ring();
+	void flush();
+
+public:
+	request_log(verbosity level = verbosity::all, unsigned sample_rate = 100, uint64_t slow_query_time = 0);
+	// writes out what is left
+	~request_log();
+
+	request_log(const request_log &) = delete;
+	request_log &operator=(const request_log &) = delete;
+
+	// never blocks. safe to call from multiple threads
+	void log(const request_record &record);
+	uint64_t dropped() const;
+	// requests taking at least this many microseconds count as slow. 0 if slow requests aren't logged
+	uint64_t slow_query_time() const;
+};
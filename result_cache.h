@@ -0,0 +1,249 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <list>
+#include <array>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include <initializer_list>
+
+#include "fuzzy.hpp"
+
+// caches the result lists of searches. the cache is split into shards with a lock each, and every shard keeps
+// its entries in least recently used order within its part of the memory budget. a new entry only pushes out
+// the least recently used ones if its key was asked for more often recently (TinyLFU admission),
+// so a burst of one-off queries can't flush the popular ones.
+// results point into the database they came from, so a cache must not outlive it
+template <typename T>
+class result_cache
+{
+public:
+	using results = std::shared_ptr<const fuzzy::result_list<T>>;
+
+	struct statistics
+	{
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		uint64_t insertions = 0;
+		// entries that weren't admitted, because what they would have replaced was more popular
+		uint64_t rejections = 0;
+		uint64_t evictions = 0;
+		size_t entries = 0;
+		// approximate, in bytes
+		size_t memory = 0;
+	};
+
+private:
+	// estimates how often keys were asked for: a count-min sketch of small counters,
+	// which are halved every sample_size additions so that old popularity fades
+	class frequency_sketch
+	{
+		static constexpr unsigned depth = 4;
+		static constexpr uint8_t max_count = 15;
+
+		std::vector<uint8_t> counters_;
+		size_t mask_ = 0;
+		size_t additions_ = 0;
+		size_t sample_size_ = 0;
+
+		size_t index(uint64_t hash, unsigned row) const
+		{
+			hash += (row + 1) * 0x9e3779b97f4a7c15ull;
+			hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ull;
+			hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebull;
+			return row * (mask_ + 1) + ((hash ^ (hash >> 31)) & mask_);
+		}
+
+	public:
+		// width has to be a power of two
+		void reset(size_t width)
+		{
+			counters_.assign(depth * width, 0);
+			mask_ = width - 1;
+			additions_ = 0;
+			sample_size_ = 10 * width;
+		}
+
+		void add(uint64_t hash)
+		{
+			for (unsigned row = 0; row < depth; row++)
+			{
+				uint8_t &counter = counters_[index(hash, row)];
+				counter += counter < max_count;
+			}
+			if (++additions_ == sample_size_)
+			{
+				for (uint8_t &counter : counters_)
+				{
+					counter /= 2;
+				}
+				additions_ /= 2;
+			}
+		}
+
+		uint8_t estimate(uint64_t hash) const
+		{
+			uint8_t count = max_count;
+			for (unsigned row = 0; row < depth; row++)
+			{
+				count = std::min(count, counters_[index(hash, row)]);
+			}
+			return count;
+		}
+	};
+
+	struct entry
+	{
+		std::string key;
+		uint64_t hash;
+		results value;
+		size_t size;
+	};
+
+	struct shard
+	{
+		std::mutex mutex;
+		// most recently used first
+		std::list<entry> entries;
+		// the keys are views of the keys in entries
+		std::unordered_map<std::string_view, typename std::list<entry>::iterator> index;
+		frequency_sketch frequencies;
+		size_t memory = 0;
+		statistics stats;
+	};
+
+	static constexpr size_t shard_count = 16;
+	// what an entry costs besides its key and results: list and map nodes, the result list and its control block
+	static constexpr size_t entry_overhead = 160;
+
+	const size_t shard_budget_;
+	std::array<shard, shard_count> shards_;
+
+	shard &shard_for(uint64_t hash)
+	{
+		return shards_[(hash * 0x9e3779b97f4a7c15ull) >> 60];
+	}
+
+public:
+	// budget is the memory the cache may use in bytes, 0 disables it
+	explicit result_cache(size_t budget = 0)
+		: shard_budget_(budget / shard_count)
+	{
+		// the sketches count about as many keys as a shard can hold, assuming a few hundred bytes per entry
+		size_t width = 16;
+		while (width < shard_budget_ / 256)
+		{
+			width *= 2;
+		}
+		for (shard &shard : shards_)
+		{
+			shard.frequencies.reset(enabled() ? width : 1);
+		}
+	}
+
+	result_cache(const result_cache &) = delete;
+	result_cache &operator=(const result_cache &) = delete;
+
+	bool enabled() const
+	{
+		return shard_budget_ > 0;
+	}
+
+	// identifies a search by the endpoint, its parameters and the normalized query. the length of the raw query is
+	// included, since fuzzycomplete cuts names to it
+	static std::string key(std::string_view endpoint, std::string_view query, std::initializer_list<long> parameters = {})
+	{
+		const fuzzy::string normalized_query = fuzzy::internal::to_ngram_string(query);
+		std::string key(endpoint);
+		for (long parameter : parameters)
+		{
+			key += '\0' + std::to_string(parameter);
+		}
+		key += '\0' + std::to_string(query.size()) + '\0';
+		key.append(normalized_query.begin(), normalized_query.end());
+		return key;
+	}
+
+	// nullptr if the results aren't cached. safe to call from multiple threads
+	results find(const std::string &key)
+	{
+		const uint64_t hash = std::hash<std::string>{}(key);
+		shard &shard = shard_for(hash);
+		std::lock_guard lock(shard.mutex);
+		shard.frequencies.add(hash);
+		const auto entry = shard.index.find(key);
+		if (entry == shard.index.end())
+		{
+			shard.stats.misses++;
+			return nullptr;
+		}
+		shard.stats.hits++;
+		shard.entries.splice(shard.entries.begin(), shard.entries, entry->second);
+		return entry->second->value;
+	}
+
+	// safe to call from multiple threads
+	void insert(const std::string &key, results value)
+	{
+		const size_t size = entry_overhead + key.size() + value->size() * sizeof(fuzzy::result<T>);
+		if (size > shard_budget_)
+		{
+			return;
+		}
+		const uint64_t hash = std::hash<std::string>{}(key);
+		shard &shard = shard_for(hash);
+		std::lock_guard lock(shard.mutex);
+		if (shard.index.contains(key))
+		{
+			// another request got there first
+			return;
+		}
+
+		// the entries that would make room, they all have to be less popular than the new one
+		const uint8_t frequency = shard.frequencies.estimate(hash);
+		size_t freed = 0;
+		size_t victims = 0;
+		for (auto victim = shard.entries.rbegin(); shard.memory - freed + size > shard_budget_; ++victim, victims++)
+		{
+			if (shard.frequencies.estimate(victim->hash) >= frequency)
+			{
+				shard.stats.rejections++;
+				return;
+			}
+			freed += victim->size;
+		}
+		for (; victims > 0; victims--)
+		{
+			shard.index.erase(shard.entries.back().key);
+			shard.memory -= shard.entries.back().size;
+			shard.entries.pop_back();
+			shard.stats.evictions++;
+		}
+
+		shard.entries.push_front(entry{key, hash, std::move(value), size});
+		shard.index.emplace(shard.entries.front().key, shard.entries.begin());
+		shard.memory += size;
+		shard.stats.insertions++;
+	}
+
+	statistics stats()
+	{
+		statistics total;
+		for (shard &shard : shards_)
+		{
+			std::lock_guard lock(shard.mutex);
+			total.hits += shard.stats.hits;
+			total.misses += shard.stats.misses;
+			total.insertions += shard.stats.insertions;
+			total.rejections += shard.stats.rejections;
+			total.evictions += shard.stats.evictions;
+			total.entries += shard.entries.size();
+			total.memory += shard.memory;
+		}
+		return total;
+	}
+};
@@ -0,0 +1,64 @@
+#include "snapshot.h"
+
+#include <filesystem>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+std::string snapshot_fingerprint(const std::vector<const char *> &dataset_paths, const std::string &options)
+{
+	std::string fingerprint = options;
+	for (const char *path : dataset_paths)
+	{
+		std::error_code size_error, time_error;
+		const auto size = std::filesystem::file_size(path, size_error);
+		const auto modified = std::filesystem::last_write_time(path, time_error);
+		fingerprint += '\n';
+		fingerprint += path;
+		if (size_error || time_error)
+			fingerprint += " missing";
+		else
+			fingerprint += ' ' + std::to_string(size) + ' ' + std::to_string(modified.time_since_epoch().count());
+	}
+	return fingerprint;
+}
+
+mapped_file::~mapped_file()
+{
+	if (data_)
+	{
+		munmap(const_cast<char *>(data_), size_);
+	}
+}
+
+bool mapped_file::open(const char *path)
+{
+	const int file = ::open(path, O_RDONLY);
+	if (file < 0)
+	{
+		return false;
+	}
+	struct stat file_stat;
+	if (fstat(file, &file_stat) != 0 || file_stat.st_size == 0)
+	{
+		close(file);
+		return false;
+	}
+	void *mapping = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	close(file);
+	if (mapping == MAP_FAILED)
+	{
+		return false;
+	}
+	madvise(mapping, file_stat.st_size, MADV_SEQUENTIAL);
+	data_ = static_cast<const char *>(mapping);
+	size_ = file_stat.st_size;
+	return true;
+}
+
+std::span<const char> mapped_file::data() const
+{
+	return std::span<const char>(data_, size_);
+}
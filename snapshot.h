@@ -0,0 +1,118 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <cstdio>
+
+#include "fuzzy.hpp"
+#include "dataset.h"
+
+// a snapshot holds a built database along with the line tables of its datasets,
+// so a restart with unchanged dataset files and options skips parsing and indexing
+
+// the bytes "FZASNAP" followed by a zero byte on little endian machines, since it is written in native byte order
+constexpr uint64_t snapshot_magic = 0x50414e53415a46;
+constexpr uint32_t snapshot_version = 3;
+
+// identifies what a snapshot was built from:
+// the given options, and the path, size and modification time of every dataset file
+std::string snapshot_fingerprint(const std::vector<const char *> &dataset_paths, const std::string &options);
+
+// a read-only mapping of a whole file
+class mapped_file
+{
+	const char *data_ = nullptr;
+	size_t size_ = 0;
+
+public:
+	mapped_file() = default;
+	~mapped_file();
+
+	mapped_file(const mapped_file &) = delete;
+	mapped_file &operator=(const mapped_file &) = delete;
+
+	bool open(const char *path);
+	std::span<const char> data() const;
+};
+
+template <typename T>
+bool save_snapshot(const std::string &path, const std::string &fingerprint, const fuzzy::database<T> &database,
+	const std::vector<std::unique_ptr<dataset>> &datasets)
+{
+	// written next to the snapshot and renamed, so a crash never leaves a partial snapshot behind
+	const std::string temporary_path = path + ".tmp";
+	{
+		std::ofstream out(temporary_path, std::ios::binary | std::ios::trunc);
+		fuzzy::internal::snapshot_writer writer(out);
+		writer.write(snapshot_magic);
+		writer.write(snapshot_version);
+		writer.write_array(fingerprint);
+		writer.write<uint64_t>(datasets.size());
+		for (const auto &set : datasets)
+		{
+			writer.write_array(std::string_view(set->path()));
+			writer.write_array(set->file_offsets());
+			writer.write_array(set->line_lengths());
+		}
+		database.save(writer);
+		if (!out.flush())
+		{
+			std::remove(temporary_path.c_str());
+			return false;
+		}
+	}
+	return std::rename(temporary_path.c_str(), path.c_str()) == 0;
+}
+
+// loads the database and datasets from a snapshot, if it exists and matches the fingerprint.
+// the datasets are opened with the given storage. nothing is touched if loading fails
+template <typename T>
+bool load_snapshot(const std::string &path, const std::string &fingerprint, fuzzy::database<T> &database,
+	std::vector<std::unique_ptr<dataset>> &datasets, const std::vector<const char *> &dataset_paths, dataset::storage storage)
+{
+	mapped_file file;
+	if (!file.open(path.c_str()))
+	{
+		return false;
+	}
+	fuzzy::internal::snapshot_reader reader(file.data());
+	if (reader.read<uint64_t>() != snapshot_magic || reader.read<uint32_t>() != snapshot_version)
+	{
+		return false;
+	}
+	const auto stored_fingerprint = reader.read_array<char>();
+	if (std::string_view(stored_fingerprint.data(), stored_fingerprint.size()) != fingerprint)
+	{
+		return false;
+	}
+
+	std::vector<std::unique_ptr<dataset>> loaded_datasets;
+	const uint64_t dataset_count = reader.read<uint64_t>();
+	for (uint64_t i = 0; i < dataset_count && reader.good(); i++)
+	{
+		const auto stored_path = reader.read_array<char>();
+		auto file_offsets = reader.read_array<uint64_t>();
+		auto line_lengths = reader.read_array<uint32_t>();
+		// the fingerprint covers all paths, so this only fails for broken snapshots
+		const auto dataset_path = std::find_if(dataset_paths.begin(), dataset_paths.end(), [&](const char *dataset_path)
+			{ return std::string_view(dataset_path) == std::string_view(stored_path.data(), stored_path.size()); });
+		if (!reader.good() || dataset_path == dataset_paths.end() || file_offsets.size() != line_lengths.size())
+		{
+			return false;
+		}
+		loaded_datasets.push_back(std::make_unique<dataset>(*dataset_path, storage, std::move(file_offsets), std::move(line_lengths)));
+		if (!loaded_datasets.back()->ready())
+		{
+			return false;
+		}
+	}
+	if (!reader.good() || !database.load(reader))
+	{
+		return false;
+	}
+	datasets = std::move(loaded_datasets);
+	return true;
+}
@@ -0,0 +1,108 @@
+// reads random lines of a dataset from many threads at once, in every storage mode,
+// and checks them against the lines that were written. disk mode shares one file descriptor between all readers
+#include "../dataset.h"
+
+#include <thread>
+#include <random>
+#include <filesystem>
+#include <fstream>
+#include <cstdio>
+#include <unistd.h>
+
+namespace
+{
+	constexpr unsigned reader_count = 32;
+	constexpr size_t reads_per_reader = 50000;
+
+	std::vector<std::string> make_lines()
+	{
+		std::mt19937 rng(12);
+		std::vector<std::string> lines;
+		for (size_t i = 0; i < 200000; i++)
+		{
+			// mostly short lines, some longer than a page and a few longer than a parse chunk
+			size_t length = 20 + rng() % 200;
+			if (i % 1000 == 0)
+				length = 5000 + rng() % 20000;
+			if (i % 50000 == 1)
+				length = (1 << 20) + rng() % (1 << 20);
+			std::string line = "{\"name\": \"" + std::to_string(i) + " ";
+			while (line.size() < length)
+			{
+				line += i % 3 ? "Köln Straße " : "abcdefghij ";
+			}
+			line += "\"}";
+			lines.push_back(std::move(line));
+		}
+		// the last line has no newline
+		lines.push_back("{\"name\": \"last\"}");
+		return lines;
+	}
+
+	size_t check(const char *path, dataset::storage storage, const std::vector<std::string> &lines)
+	{
+		std::atomic_bool abort_flag = false;
+		const dataset::element_parser parser = [](std::string_view, dataset::parsed_element &) {};
+		const dataset::element_handler handler = [](dataset::element_id, std::string_view, dataset::parsed_element &&) {};
+		const dataset data(path, storage, abort_flag, parser, handler);
+		if (data.size() != lines.size())
+		{
+			std::printf("loaded %zu of %zu lines\n", data.size(), lines.size());
+			return 1;
+		}
+
+		std::atomic<size_t> mismatches = 0;
+		std::vector<std::thread> readers;
+		for (unsigned reader = 0; reader < reader_count; reader++)
+		{
+			readers.emplace_back([&, reader]
+				{
+					std::mt19937 rng(reader);
+					std::string buffer;
+					for (size_t i = 0; i < reads_per_reader; i++)
+					{
+						const dataset::element_id id = rng() % lines.size();
+						if (data.get_element(id, buffer) != lines[id])
+							mismatches++;
+					}
+				});
+		}
+		for (auto &reader : readers)
+		{
+			reader.join();
+		}
+		return mismatches;
+	}
+}
+
+int main()
+{
+	const std::string path = (std::filesystem::temp_directory_path() / ("disk_stress_test." + std::to_string(getpid()) + ".ndjson")).string();
+	const std::vector<std::string> lines = make_lines();
+	{
+		std::ofstream file(path, std::ios::binary);
+		for (size_t i = 0; i < lines.size(); i++)
+		{
+			file << lines[i];
+			if (i + 1 < lines.size())
+				file << '\n';
+		}
+	}
+
+	size_t failures = 0;
+	const std::pair<const char *, dataset::storage> modes[] = {
+		{"memory", dataset::storage::memory}, {"disk", dataset::storage::disk}, {"mapped", dataset::storage::mapped}};
+	for (const auto &[name, storage] : modes)
+	{
+		const size_t mismatches = check(path.c_str(), storage, lines);
+		if (mismatches)
+		{
+			std::printf("%s mode: %zu of %zu reads returned the wrong line\n", name, mismatches, reader_count * reads_per_reader);
+		}
+		failures += mismatches;
+	}
+	std::filesystem::remove(path);
+
+	std::printf("disk_stress_test: %zu failures\n", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,163 @@
+// checks the bit-parallel osa kernels against a plain dp, on random pairs of up to 200 characters
+// (so one, two, three and four words of the multi-word kernel) and on utf-8 names
+#include "../fuzzy.hpp"
+
+#include <random>
+#include <cstdio>
+
+using fuzzy::internal::osa_distance;
+using fuzzy::internal::osa_matcher;
+
+namespace
+{
+	// the dp osa_distance used to be, with the transposition reading the row before the previous one
+	// (the old code read the previous row, which isn't osa)
+	int reference_distance(fuzzy::string_view s1, fuzzy::string_view s2)
+	{
+		const size_t len_s1 = s1.size();
+		const size_t len_s2 = s2.size();
+		std::vector<int> before_prev(len_s2 + 1);
+		std::vector<int> prev(len_s2 + 1);
+		std::vector<int> curr(len_s2 + 1);
+		for (size_t j = 0; j <= len_s2; j++)
+		{
+			prev[j] = j;
+		}
+		for (size_t i = 1; i <= len_s1; i++)
+		{
+			curr[0] = i;
+			for (size_t j = 1; j <= len_s2; j++)
+			{
+				const int cost = s1[i - 1] == s2[j - 1] ? 0 : 1;
+				curr[j] = std::min({prev[j] + 1, curr[j - 1] + 1, prev[j - 1] + cost});
+				if (i > 1 && j > 1 && s1[i - 1] == s2[j - 2] && s1[i - 2] == s2[j - 1])
+				{
+					curr[j] = std::min(curr[j], before_prev[j - 2] + 1);
+				}
+			}
+			std::swap(before_prev, prev);
+			std::swap(prev, curr);
+		}
+		return prev[len_s2];
+	}
+
+	size_t failures = 0;
+	size_t checks = 0;
+
+	void check(fuzzy::string_view a, fuzzy::string_view b)
+	{
+		const int expected = reference_distance(a, b);
+		const osa_matcher matcher(a);
+		const int results[] = {osa_distance(a, b), osa_distance(b, a), matcher.distance(b), osa_matcher(b).distance(a)};
+		bool ok = std::ranges::all_of(results, [&](int result) { return result == expected; });
+		// a bounded distance only has to be right up to the bound
+		for (int max_distance : {0, 1, 2, 3, 5, 8, 40})
+		{
+			const int bounded = matcher.distance(b, max_distance);
+			ok &= expected <= max_distance ? bounded == expected : bounded > max_distance;
+		}
+		checks++;
+		if (!ok && failures++ < 10)
+		{
+			std::printf("mismatch for lengths %zu and %zu: expected %d, got %d %d %d %d\n",
+				a.size(), b.size(), expected, results[0], results[1], results[2], results[3]);
+		}
+	}
+
+	// a copy of str with up to edits random insertions, deletions, substitutions and transpositions
+	fuzzy::string mutate(fuzzy::string str, int edits, const fuzzy::string &alphabet, std::mt19937 &rng)
+	{
+		for (; edits > 0; edits--)
+		{
+			const size_t position = str.empty() ? 0 : rng() % str.size();
+			const fuzzy::ngram_char c = alphabet[rng() % alphabet.size()];
+			switch (rng() % 4)
+			{
+			case 0:
+				str.insert(str.begin() + position, c);
+				break;
+			case 1:
+				if (!str.empty())
+					str.erase(position, 1);
+				break;
+			case 2:
+				if (!str.empty())
+					str[position] = c;
+				break;
+			default:
+				if (position + 1 < str.size())
+					std::swap(str[position], str[position + 1]);
+				break;
+			}
+		}
+		return str;
+	}
+}
+
+int main()
+{
+	std::mt19937 rng(1);
+
+	// small alphabets make for many matches and transpositions, the full byte range covers every mask
+	for (int round = 0; round < 200000; round++)
+	{
+		const size_t max_length = round % 10 == 0 ? 200 : 70;
+		fuzzy::string alphabet;
+		if (round % 5 == 4)
+		{
+			for (int c = 0; c < 256; c++)
+				alphabet.push_back(c);
+		}
+		else
+		{
+			for (size_t c = 0, size = 2 + rng() % 6; c < size; c++)
+				alphabet.push_back('a' + c);
+		}
+		fuzzy::string a;
+		for (size_t i = 0, length = rng() % (max_length + 1); i < length; i++)
+		{
+			a.push_back(alphabet[rng() % alphabet.size()]);
+		}
+		fuzzy::string b;
+		if (round % 2)
+		{
+			b = mutate(a, rng() % 6, alphabet, rng);
+		}
+		else
+		{
+			for (size_t i = 0, length = rng() % (max_length + 1); i < length; i++)
+				b.push_back(alphabet[rng() % alphabet.size()]);
+		}
+		check(a, b);
+	}
+
+	// names as the database sees them, multi-byte characters included
+	const char *const names[] = {
+		"Köln", "Koln", "Kölner Dom", "Straße", "Strasse", "Zürich Hauptbahnhof", "Zuerich Hbf", "São Paulo", "Sao Paulo",
+		"Αθήνα", "Athina", "Москва", "Moskva", "東京都", "東京", "Ærøskøbing", "Aeroskobing", "İstanbul", "istanbul",
+		"Łódź", "Lodz", "Café \"Zentral\"", "Cafe Zentral", "Ⅻ Ⅻ 𝄞 music", "",
+		"Llanfairpwllgwyngyllgogerychwyrndrobwllllantysiliogogogoch Ærøskøbing Zürich Hauptbahnhof São Paulo",
+		"Llanfairpwllgwyngyllgogerychwyrndrobwllantysiliogogogoch Ærøskøbing Zurich Hauptbahnhof Sao Paulo Köln",
+	};
+	std::vector<fuzzy::string> internal_names;
+	for (const char *name : names)
+	{
+		internal_names.push_back(fuzzy::internal::to_ngram_string(name));
+	}
+	for (const auto &a : internal_names)
+	{
+		for (const auto &b : internal_names)
+		{
+			check(a, b);
+		}
+	}
+	for (int round = 0; round < 2000; round++)
+	{
+		const auto &name = internal_names[rng() % internal_names.size()];
+		const fuzzy::string alphabet = name.empty() ? fuzzy::string(1, 'a') : name;
+		check(name, mutate(name, rng() % 5, alphabet, rng));
+	}
+
+	std::printf("osa_test: %zu of %zu checks failed\n", failures, checks);
+	return failures ? 1 : 0;
+}
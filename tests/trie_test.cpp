@@ -0,0 +1,109 @@
+// checks the trie search behind short /fuzzycomplete queries against a scan of all names,
+// on a database with empty names in it, which must never turn up as results
+#include "../fuzzy.hpp"
+
+#include <random>
+#include <map>
+#include <cstdio>
+
+namespace
+{
+	size_t failures = 0;
+	size_t checks = 0;
+
+	// (line, distance) of every result
+	using found = std::multimap<int, int>;
+
+	// what completion_fuzzy_search has to find: every name within distance_range of the best one,
+	// cut to the length of the query like fuzzycomplete does
+	found scan(const std::vector<std::string> &names, const std::string &query, bool first_letter_opt, int distance_range)
+	{
+		const fuzzy::string query_internal = fuzzy::internal::to_ngram_string(query);
+		std::vector<std::pair<int, int>> distances;
+		for (size_t line = 0; line < names.size(); line++)
+		{
+			const fuzzy::string name = fuzzy::internal::to_ngram_string(names[line]);
+			if (name.empty() || (first_letter_opt && name[0] != query_internal[0]))
+				continue;
+			distances.emplace_back(line, fuzzy::internal::osa_distance(query_internal, fuzzy::string_view(name).substr(0, query.size())));
+		}
+		int best = INT_MAX;
+		for (const auto &[line, distance] : distances)
+		{
+			best = std::min(best, distance);
+		}
+		found expected;
+		for (const auto &[line, distance] : distances)
+		{
+			if (distance <= best + distance_range)
+				expected.emplace(line, distance);
+		}
+		return expected;
+	}
+
+	void check(const std::vector<std::string> &names, const std::vector<std::string> &queries, bool first_letter_opt)
+	{
+		fuzzy::sorted_database<int> database(2, 100, first_letter_opt);
+		for (size_t line = 0; line < names.size(); line++)
+		{
+			database.add(names[line], int(line));
+		}
+		database.build();
+
+		for (const std::string &query : queries)
+		{
+			const auto results = database.completion_fuzzy_search(query, fuzzy::result_collection<int>(SIZE_MAX, 1, true)).all();
+			found actual;
+			for (const auto &result : results)
+			{
+				actual.emplace(result.element->meta, result.distance);
+			}
+			const found expected = scan(names, query, first_letter_opt, 1);
+			checks++;
+			if (actual != expected && failures++ < 10)
+			{
+				std::printf("query \"%s\" (first letter %d): %zu results, expected %zu\n", query.c_str(), first_letter_opt, actual.size(), expected.size());
+			}
+		}
+	}
+}
+
+int main()
+{
+	// empty names, and names without a single valid utf-8 character, leave entries that have no name
+	const std::vector<std::string> names = {"Zebra", "", "apple", "apricot", "\xff\xfe", "ape", "", "Apfel", "Äpfel", "zap", ""};
+	for (bool first_letter_opt : {false, true})
+	{
+		check(names, {"ap", "a", "z", "zz", "äp", "pa", "xyz", "apricot", "aple"}, first_letter_opt);
+	}
+
+	std::mt19937 rng(5);
+	const char *const alphabet[] = {"a", "b", "c", "d", "e", "ö", " "};
+	std::vector<std::string> random_names;
+	for (int i = 0; i < 5000; i++)
+	{
+		std::string name;
+		for (size_t length = i % 10 == 0 ? 0 : 1 + rng() % 10; length > 0; length--)
+		{
+			name += alphabet[rng() % std::size(alphabet)];
+		}
+		random_names.push_back(name);
+	}
+	std::vector<std::string> queries;
+	for (int i = 0; i < 300; i++)
+	{
+		std::string query;
+		for (size_t length = 1 + rng() % 4; query.size() < length;)
+		{
+			query += "abcdef"[rng() % 6];
+		}
+		queries.push_back(query);
+	}
+	for (bool first_letter_opt : {false, true})
+	{
+		check(random_names, queries, first_letter_opt);
+	}
+
+	std::printf("trie_test: %zu of %zu queries failed\n", failures, checks);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <utility>
+
+#include "fuzzy.hpp"
+
+// what the last fuzzy completion of every typeahead session left behind, see fuzzy::database::typeahead_search.
+// a request takes the state of its session out and puts the new one back, so two requests of a session running
+// at the same time dont build on each other, one of them just starts over. the sessions used least recently
+// are dropped once there are more than the capacity.
+// the states refer to elements by id, so they must only be used with the database they came from
+class typeahead_sessions
+{
+	struct session
+	{
+		std::string key;
+		fuzzy::typeahead_state state;
+	};
+
+	const size_t capacity_;
+	std::mutex mutex_;
+	// most recently used first
+	std::list<session> sessions_;
+	// the keys are views of the keys in sessions_
+	std::unordered_map<std::string_view, std::list<session>::iterator> index_;
+
+public:
+	// capacity is the most sessions kept, 0 disables them
+	explicit typeahead_sessions(size_t capacity = 0)
+		: capacity_(capacity)
+	{
+	}
+
+	typeahead_sessions(const typeahead_sessions &) = delete;
+	typeahead_sessions &operator=(const typeahead_sessions &) = delete;
+
+	bool enabled() const
+	{
+		return capacity_ > 0;
+	}
+
+	// identifies a session by the token the client sent, the endpoint and the parameters of the search,
+	// a session only builds on searches that were made the same way
+	static std::string key(std::string_view token, std::string_view endpoint, long parameter)
+	{
+		std::string key(token);
+		key += '\0';
+		key += endpoint;
+		key += '\0' + std::to_string(parameter);
+		return key;
+	}
+
+	// an empty state if the session is unknown. safe to call from multiple threads
+	fuzzy::typeahead_state take(const std::string &key)
+	{
+		std::lock_guard lock(mutex_);
+		const auto session = index_.find(key);
+		if (session == index_.end())
+		{
+			return fuzzy::typeahead_state();
+		}
+		const auto entry = session->second;
+		index_.erase(session);
+		fuzzy::typeahead_state state = std::move(entry->state);
+		sessions_.erase(entry);
+		return state;
+	}
+
+	// safe to call from multiple threads
+	void put(const std::string &key, fuzzy::typeahead_state &&state)
+	{
+		if (!enabled())
+		{
+			return;
+		}
+		std::lock_guard lock(mutex_);
+		if (index_.contains(key))
+		{
+			// another request of the session got there first
+			return;
+		}
+		sessions_.push_front(session{key, std::move(state)});
+		index_.emplace(sessions_.front().key, sessions_.begin());
+		if (sessions_.size() > capacity_)
+		{
+			index_.erase(sessions_.back().key);
+			sessions_.pop_back();
+		}
+	}
+
+	size_t size()
+	{
+		std::lock_guard lock(mutex_);
+		return sessions_.size();
+	}
+};
@@ -1,6 +1,10 @@
 #pragma once
 
 #include <chrono>
+#include <fstream>
+#include <string>
+#include <sys/resource.h>
+#include <unistd.h>
 
 class timer
 {
@@ -35,4 +39,39 @@ public:
 		reset();
 		return v;
 	}
-};
\ No newline at end of file
+};
+
+// resident memory of the process in KiB
+inline uint64_t memory_usage()
+{
+	uint64_t total_pages = 0, resident_pages = 0;
+	std::ifstream("/proc/self/statm") >> total_pages >> resident_pages;
+	return resident_pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// the highest resident memory of the process in KiB, since it started or since the last reset_peak_memory_usage
+inline uint64_t peak_memory_usage()
+{
+	// getrusage only knows the peak over the whole lifetime of the process
+	std::ifstream status("/proc/self/status");
+	for (std::string line; std::getline(status, line);)
+	{
+		if (line.starts_with("VmHWM:"))
+		{
+			return std::stoull(line.substr(6));
+		}
+	}
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+// starts measuring the peak from the current resident memory. false if the kernel doesn't support it,
+// then peak_memory_usage keeps reporting the peak since the start
+inline bool reset_peak_memory_usage()
+{
+	std::ofstream clear_refs("/proc/self/clear_refs");
+	clear_refs << "5";
+	clear_refs.flush();
+	return bool(clear_refs);
+}
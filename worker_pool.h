@@ -0,0 +1,124 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+
+// threads that live as long as the server and share out the work of batch requests. since they are reused,
+// their thread local scratch (the hit counters of fuzzy searches, the request log rings) is only set up once,
+// and concurrent batches share them instead of starting threads of their own
+class worker_pool
+{
+	// one for_each call, kept alive by the tasks that may still be queued after it returned
+	struct job
+	{
+		const std::function<void(size_t)> *func;
+		size_t count;
+		std::atomic_size_t next = 0;
+		std::mutex mutex;
+		std::condition_variable finished_signal;
+		size_t finished = 0;
+
+		// takes indices until none are left
+		void work()
+		{
+			size_t done = 0;
+			for (size_t index; (index = next++) < count; done++)
+			{
+				(*func)(index);
+			}
+			if (done == 0)
+			{
+				return;
+			}
+			std::lock_guard lock(mutex);
+			finished += done;
+			if (finished == count)
+			{
+				finished_signal.notify_all();
+			}
+		}
+	};
+
+	std::mutex mutex_;
+	std::condition_variable work_available_;
+	std::deque<std::shared_ptr<job>> tasks_;
+	bool stopping_ = false;
+	std::vector<std::thread> workers_;
+
+public:
+	explicit worker_pool(unsigned thread_count)
+	{
+		for (unsigned i = 0; i < thread_count; i++)
+		{
+			workers_.emplace_back([this]
+				{
+					std::unique_lock lock(mutex_);
+					while (true)
+					{
+						work_available_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+						if (tasks_.empty())
+						{
+							return;
+						}
+						const std::shared_ptr<job> task = std::move(tasks_.front());
+						tasks_.pop_front();
+						lock.unlock();
+						task->work();
+						lock.lock();
+					}
+				});
+		}
+	}
+
+	~worker_pool()
+	{
+		{
+			std::lock_guard lock(mutex_);
+			stopping_ = true;
+		}
+		work_available_.notify_all();
+		for (auto &worker : workers_)
+		{
+			worker.join();
+		}
+	}
+
+	worker_pool(const worker_pool &) = delete;
+	worker_pool &operator=(const worker_pool &) = delete;
+
+	// calls func(index) for every index in [0, count) and returns once all calls are done. the calling thread works
+	// along, so a batch makes progress even while the workers are busy with other batches. func must not throw.
+	// safe to call from multiple threads
+	void for_each(size_t count, const std::function<void(size_t)> &func)
+	{
+		if (count == 0)
+		{
+			return;
+		}
+		const auto current = std::make_shared<job>();
+		current->func = &func;
+		current->count = count;
+		const size_t helpers = std::min(count - 1, workers_.size());
+		if (helpers > 0)
+		{
+			{
+				std::lock_guard lock(mutex_);
+				tasks_.insert(tasks_.end(), helpers, current);
+			}
+			for (size_t i = 0; i < helpers; i++)
+			{
+				work_available_.notify_one();
+			}
+		}
+		current->work();
+		std::unique_lock lock(current->mutex);
+		current->finished_signal.wait(lock, [&] { return current->finished == count; });
+	}
+};